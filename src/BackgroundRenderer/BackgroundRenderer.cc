@@ -21,7 +21,7 @@ namespace pdf2htmlEX {
 std::unique_ptr<BackgroundRenderer> BackgroundRenderer::getBackgroundRenderer(const std::string & format, HTMLRenderer * html_renderer, const Param & param)
 {
 #ifdef ENABLE_LIBPNG
-    if(format == "png")
+    if((format == "png") || (format == "auto"))
     {
         return std::unique_ptr<BackgroundRenderer>(new SplashBackgroundRenderer(format, html_renderer, param));
     }
@@ -32,6 +32,18 @@ std::unique_ptr<BackgroundRenderer> BackgroundRenderer::getBackgroundRenderer(co
         return std::unique_ptr<BackgroundRenderer>(new SplashBackgroundRenderer(format, html_renderer, param));
     }
 #endif
+#if ENABLE_WEBP
+    if(format == "webp")
+    {
+        return std::unique_ptr<BackgroundRenderer>(new SplashBackgroundRenderer(format, html_renderer, param));
+    }
+#endif
+#if ENABLE_AVIF
+    if(format == "avif")
+    {
+        return std::unique_ptr<BackgroundRenderer>(new SplashBackgroundRenderer(format, html_renderer, param));
+    }
+#endif
 #if ENABLE_SVG
     if (format == "svg")
     {
@@ -36,6 +36,9 @@ public:
     //return true on success, false otherwise (e.g. need a fallback)
     virtual bool render_page(PDFDoc * doc, int pageno) = 0;
     virtual void embed_image(int pageno) = 0;
+    // for --thumbnail-width, called after render_page()
+    // write a thumbnail of the page into dest_dir, return its filename, or "" if not supported
+    virtual std::string dump_thumbnail(int pageno) { return ""; }
 
     // for proof output
 protected:
@@ -6,11 +6,21 @@
 
 #include <string>
 #include <fstream>
-
+#include <algorithm>
+#include <sstream>
+#include <cstring>
+#include <cstdio>
+#include <memory>
 
 #include "pdf2htmlEX-config.h"
 
+#include <poppler-config.h>
+#include <goo/ImgWriter.h>
+#include <goo/JpegWriter.h>
+
 #include "Base64Stream.h"
+#include "util/image.h"
+#include "util/svg.h"
 
 #if ENABLE_SVG
 
@@ -24,12 +34,15 @@ using std::ifstream;
 using std::ofstream;
 using std::vector;
 using std::unordered_map;
+using std::unique_ptr;
 
 CairoBackgroundRenderer::CairoBackgroundRenderer(HTMLRenderer * html_renderer, const Param & param)
     : CairoOutputDev()
     , html_renderer(html_renderer)
     , param(param)
     , surface(nullptr)
+    , drawing_count(0)
+    , node_count(0)
 { }
 
 CairoBackgroundRenderer::~CairoBackgroundRenderer()
@@ -51,29 +64,157 @@ void CairoBackgroundRenderer::drawChar(GfxState *state, double x, double y,
     // draw characters as image when
     // - in fallback mode
     // - OR there is special filling method
-    // - OR using a writing mode font
+    // - OR using a writing mode font while param.process_vertical_text is not enabled
     // - OR using a Type 3 font while param.process_type3 is not enabled
     // - OR the text is used as path
     if((param.fallback || param.proof)
         || ( (state->getFont())
-            && ( (state->getFont()->getWMode())
+            && ( (state->getFont()->getWMode() && (!param.process_vertical_text))
                  || ((state->getFont()->getType() == fontType3) && (!param.process_type3))
                  || (state->getRender() >= 4)
                )
           )
       )
     {
+        ++drawing_count;
         CairoOutputDev::drawChar(state,x,y,dx,dy,originX,originY,code,nBytes,u,uLen);
     }
     // If a char is treated as image, it is not subject to cover test
     // (see HTMLRenderer::drawString), so don't increase drawn_char_count.
     else if (param.correct_text_visibility) {
         if (html_renderer->is_char_covered(drawn_char_count))
+        {
+            ++drawing_count;
             CairoOutputDev::drawChar(state,x,y,dx,dy,originX,originY,code,nBytes,u,uLen);
+        }
         drawn_char_count++;
     }
 }
 
+void CairoBackgroundRenderer::drawImage(GfxState * state, Object * ref, Stream * str,
+        int width, int height, GfxImageColorMap * colorMap,
+        GBool interpolate, int *maskColors, GBool inlineImg)
+{
+    // Skip images extracted as separate elements, see HTMLRenderer::check_extracted_image()
+    if (param.extract_image && ref && ref->isRef() && (!inlineImg)
+        && html_renderer->is_image_extracted(get_image_key(ref->getRef(), state->getCTM(), getDefICTM())))
+        return;
+    ++drawing_count;
+    CairoOutputDev::drawImage(state,ref,str,width,height,colorMap,interpolate,maskColors,inlineImg);
+}
+
+void CairoBackgroundRenderer::stroke(GfxState *state)
+{
+    // Skip paths drawn with CSS, see HTMLRenderer::add_css_drawing()
+    if (param.css_draw && html_renderer->is_css_drawn(state, 's', getDefICTM()))
+        return;
+    ++drawing_count;
+    CairoOutputDev::stroke(state);
+}
+
+void CairoBackgroundRenderer::fill(GfxState *state)
+{
+    // Skip paths drawn with CSS, see HTMLRenderer::add_css_drawing()
+    if (param.css_draw && html_renderer->is_css_drawn(state, 'f', getDefICTM()))
+        return;
+    ++drawing_count;
+    CairoOutputDev::fill(state);
+}
+
+void CairoBackgroundRenderer::eoFill(GfxState *state)
+{
+    // Skip paths drawn with CSS, see HTMLRenderer::add_css_drawing()
+    if (param.css_draw && html_renderer->is_css_drawn(state, 'e', getDefICTM()))
+        return;
+    ++drawing_count;
+    CairoOutputDev::eoFill(state);
+}
+
+GBool CairoBackgroundRenderer::axialShadedFill(GfxState *state, GfxAxialShading *shading, double tMin, double tMax)
+{
+    // drawn as a CSS gradient, see HTMLRenderer::add_css_gradient()
+    if (param.css_draw && html_renderer->is_css_drawn(state, shading, getDefICTM()))
+        return gTrue;
+    ++drawing_count;
+    return CairoOutputDev::axialShadedFill(state, shading, tMin, tMax);
+}
+
+void CairoBackgroundRenderer::clip(GfxState *state)
+{
+    ++drawing_count;
+    CairoOutputDev::clip(state);
+}
+
+void CairoBackgroundRenderer::eoClip(GfxState *state)
+{
+    ++drawing_count;
+    CairoOutputDev::eoClip(state);
+}
+
+void CairoBackgroundRenderer::drawImageMask(GfxState *state, Object *ref, Stream *str,
+        int width, int height, GBool invert,
+        GBool interpolate, GBool inlineImg)
+{
+    ++drawing_count;
+    CairoOutputDev::drawImageMask(state,ref,str,width,height,invert,interpolate,inlineImg);
+}
+
+void CairoBackgroundRenderer::drawMaskedImage(GfxState *state, Object *ref, Stream *str,
+        int width, int height,
+        GfxImageColorMap *colorMap,
+        GBool interpolate,
+        Stream *maskStr,
+        int maskWidth, int maskHeight,
+        GBool maskInvert, GBool maskInterpolate)
+{
+    ++drawing_count;
+    CairoOutputDev::drawMaskedImage(state,ref,str,width,height,colorMap,interpolate,
+            maskStr,maskWidth,maskHeight,maskInvert,maskInterpolate);
+}
+
+void CairoBackgroundRenderer::drawSoftMaskedImage(GfxState *state, Object *ref, Stream *str,
+        int width, int height,
+        GfxImageColorMap *colorMap,
+        GBool interpolate,
+        Stream *maskStr,
+        int maskWidth, int maskHeight,
+        GfxImageColorMap *maskColorMap,
+        GBool maskInterpolate)
+{
+    ++drawing_count;
+    CairoOutputDev::drawSoftMaskedImage(state,ref,str,width,height,colorMap,interpolate,
+            maskStr,maskWidth,maskHeight,maskColorMap,maskInterpolate);
+}
+
+cairo_status_t CairoBackgroundRenderer::write_svg(void * renderer, const unsigned char * data, unsigned int length)
+{
+    auto * self = (CairoBackgroundRenderer *)renderer;
+    if (self->check_node_count())
+    {
+        self->node_count += std::count(data, data + length, '<');
+        // stop writing a file that will be discarded anyway
+        // this happens only when the surface is finished, after rendering
+        if (node_count_exceeded(renderer))
+            return CAIRO_STATUS_WRITE_ERROR;
+    }
+    if (self->buffer_svg())
+    {
+        self->svg_data.append((const char *)data, length);
+        return CAIRO_STATUS_SUCCESS;
+    }
+    self->svg_file.write((const char *)data, length);
+    return self->svg_file ? CAIRO_STATUS_SUCCESS : CAIRO_STATUS_WRITE_ERROR;
+}
+
+GBool CairoBackgroundRenderer::node_count_exceeded(void * renderer)
+{
+    auto * self = (CairoBackgroundRenderer *)renderer;
+    return (self->check_node_count()
+            && ((self->drawing_count > self->param.svg_node_count_limit)
+                || (self->node_count > self->param.svg_node_count_limit)))
+        ? gTrue : gFalse;
+}
+
 void CairoBackgroundRenderer::beginTextObject(GfxState *state)
 {
     if (param.proof == 2)
@@ -130,11 +271,20 @@ bool CairoBackgroundRenderer::render_page(PDFDoc * doc, int pageno)
     if (doc->getPageRotate(pageno) == 90 || doc->getPageRotate(pageno) == 270)
         std::swap(page_height, page_width);
 
-    string fn = (char*)html_renderer->str_fmt("%s/bg%x.svg", (param.embed_image ? param.tmp_dir : param.dest_dir).c_str(), pageno);
-    if(param.embed_image)
-        html_renderer->tmp_files.add(fn);
+    string fn = param.dest_dir + "/" + get_svg_filename(pageno);
 
-    surface = cairo_svg_surface_create(fn.c_str(), page_width * param.h_dpi / DEFAULT_DPI, page_height * param.v_dpi / DEFAULT_DPI);
+    svg_data.clear();
+    if(!buffer_svg())
+    {
+        svg_file.open(fn, ofstream::binary);
+        if(!svg_file)
+            throw string("Cannot open ") + fn + " for writing";
+    }
+    drawing_count = 0;
+    node_count = 0;
+
+    surface = cairo_svg_surface_create_for_stream(&write_svg, this,
+            page_width * param.h_dpi / DEFAULT_DPI, page_height * param.v_dpi / DEFAULT_DPI);
     cairo_svg_surface_restrict_to_version(surface, CAIRO_SVG_VERSION_1_2);
     cairo_surface_set_fallback_resolution(surface, param.h_dpi, param.v_dpi);
 
@@ -143,49 +293,65 @@ bool CairoBackgroundRenderer::render_page(PDFDoc * doc, int pageno)
 
     bitmaps_in_current_page.clear();
 
+    // with --svg-node-count-limit, rendering is aborted as soon as drawing_count exceeds the limit
+    // the nodes themselves are written, and counted, only by cairo_surface_finish() below
     bool process_annotation = param.process_annotation;
     doc->displayPage(this, pageno, param.h_dpi, param.v_dpi,
             0, 
             (!(param.use_cropbox)),
             false, 
             false,
-            nullptr, nullptr, &annot_cb, &process_annotation);
+            (check_node_count() ? &node_count_exceeded : nullptr), this,
+            &annot_cb, &process_annotation);
 
     setCairo(nullptr);
     
     {
         auto status = cairo_status(cr);
         cairo_destroy(cr);
-        if(status)
+        if(status && !node_count_exceeded(this))
             throw string("Cairo error: ") + cairo_status_to_string(status);
     }
 
+    // write errors are expected if writing is stopped by write_svg()
     cairo_surface_finish(surface);
     {
         auto status = cairo_surface_status(surface);
         cairo_surface_destroy(surface);
         surface = nullptr;
-        if(status)
+        if(status && !node_count_exceeded(this))
             throw string("Error in cairo: ") + cairo_status_to_string(status);
     }
+    if(!buffer_svg())
+        svg_file.close();
+
+    // count of '<' in the file should be an approximation of node count.
+    // fall back to bitmap_renderer if necessary.
+    if (node_count_exceeded(this))
+    {
+        if(!buffer_svg())
+            html_renderer->tmp_files.add(fn);
+        return false;
+    }
+
+    if(param.svg_minify)
+        svg_data = minify_svg(svg_data, param.svg_precision);
 
-    //check node count in the svg file, fall back to bitmap_renderer if necessary.
-    if (param.svg_node_count_limit >= 0)
+    if(buffer_svg() && !param.embed_image)
     {
-        int n = 0;
-        char c;
-        ifstream svgfile(fn);
-        //count of '<' in the file should be an approximation of node count.
-        while(svgfile >> c)
+        if(param.svgz)
         {
-            if (c == '<')
-                ++n;
-            if (n > param.svg_node_count_limit)
-            {
-                html_renderer->tmp_files.add(fn);
-                return false;
-            }
+            if(!write_gzip_file(fn, svg_data))
+                throw string("Cannot write ") + fn;
         }
+        else
+        {
+            ofstream fout(fn, ofstream::binary);
+            fout.write(svg_data.data(), svg_data.size());
+            if(!fout)
+                throw string("Cannot write ") + fn;
+        }
+        svg_data.clear();
     }
 
     // the svg file is actually used, so add its bitmaps' ref count.
@@ -195,9 +361,77 @@ bool CairoBackgroundRenderer::render_page(PDFDoc * doc, int pageno)
     return true;
 }
 
+/*
+ * For --svg-embed-mode inline
+ * IDs in the SVG of each page are prefixed, since they would conflict with other pages in the same HTML,
+ * the XML declaration is removed, and css_class is added to the root element
+ */
+static void write_inline_svg(std::ostream & out, const string & svg, const string & id_prefix, const char * css_class)
+{
+    size_t start = svg.find("<svg");
+    if(start == string::npos)
+        throw string("Bad SVG background image");
+    out << "<svg class=\"" << css_class << "\"";
+
+    static const char * const id_patterns[] = { "id=\"", "url(#", "href=\"#" };
+    size_t pos = start + 4;
+    while(pos < svg.size())
+    {
+        size_t next = string::npos;
+        size_t pattern_len = 0;
+        for(auto pattern : id_patterns)
+        {
+            size_t p = svg.find(pattern, pos);
+            if(p < next)
+            {
+                next = p;
+                pattern_len = strlen(pattern);
+            }
+        }
+        if(next == string::npos)
+        {
+            out.write(svg.data() + pos, svg.size() - pos);
+            break;
+        }
+        out.write(svg.data() + pos, next + pattern_len - pos);
+        out << id_prefix;
+        pos = next + pattern_len;
+    }
+}
+
+/*
+ * For --svg-embed-mode utf8
+ * Characters that are not allowed in a data URI in an HTML attribute are percent-encoded
+ */
+static void write_utf8_data_uri(std::ostream & out, const string & svg)
+{
+    for(char c : svg)
+    {
+        switch(c)
+        {
+            case '%': out << "%25"; break;
+            case '#': out << "%23"; break;
+            case '"': out << "%22"; break;
+            case '&': out << "%26"; break;
+            case '<': out << "%3C"; break;
+            case '>': out << "%3E"; break;
+            case '\n': out << "%0A"; break;
+            case '\r': break;
+            default: out << c; break;
+        }
+    }
+}
+
 void CairoBackgroundRenderer::embed_image(int pageno)
 {
     auto & f_page = *(html_renderer->f_curpage);
+
+    if(param.embed_image && (param.svg_embed_mode == "inline"))
+    {
+        write_inline_svg(f_page, svg_data, (char*)html_renderer->str_fmt("p%x-", pageno), CSS::FULL_BACKGROUND_IMAGE_CN);
+        svg_data.clear();
+        return;
+    }
     
     // SVGs introduced by <img> or background-image can't have external resources;
     // SVGs introduced by <embed> and <object> can, but they are more expensive for browsers.
@@ -216,25 +450,92 @@ void CairoBackgroundRenderer::embed_image(int pageno)
 
     if(param.embed_image)
     {
-        auto path = html_renderer->str_fmt("%s/bg%x.svg", param.tmp_dir.c_str(), pageno);
-        ifstream fin((char*)path, ifstream::binary);
-        if(!fin)
-            throw string("Cannot read background image ") + (char*)path;
-        f_page << "data:image/svg+xml;base64," << Base64Stream(fin);
+        if(param.svg_embed_mode == "utf8")
+        {
+            f_page << "data:image/svg+xml;charset=utf-8,";
+            write_utf8_data_uri(f_page, svg_data);
+        }
+        else
+        {
+            std::istringstream sin(svg_data);
+            f_page << "data:image/svg+xml;base64," << Base64Stream(sin);
+        }
+        svg_data.clear();
     }
     else
     {
-        f_page << (char*)html_renderer->str_fmt("bg%x.svg", pageno);
+        string fn = get_svg_filename(pageno);
+        auto * dup = html_renderer->find_duplicate_image(fn);
+        f_page << (dup ? dup->filename : fn);
     }
     f_page << "\"/>";
 }
 
-string CairoBackgroundRenderer::build_bitmap_path(int id)
+string CairoBackgroundRenderer::get_svg_filename(int pageno)
+{
+    // svgz is for external files only
+    return (char*)html_renderer->str_fmt((param.svgz && !param.embed_image) ? "bg%x.svgz" : "bg%x.svg", pageno);
+}
+
+string CairoBackgroundRenderer::build_bitmap_path(const string & filename)
+{
+    return param.dest_dir + "/" + filename;
+}
+
+bool CairoBackgroundRenderer::dump_bitmap(cairo_surface_t * image, const string & suffix, const string & filename)
 {
-    // "o" for "PDF Object"
-    return string(html_renderer->str_fmt("%s/o%d.jpg", param.dest_dir.c_str(), id));
+    if (suffix == "png")
+        return cairo_surface_write_to_png(image, filename.c_str()) == CAIRO_STATUS_SUCCESS;
+
+    // other formats take RGB pixels, convert from CAIRO_FORMAT_RGB24
+    int width = cairo_image_surface_get_width(image);
+    int height = cairo_image_surface_get_height(image);
+    int stride = cairo_image_surface_get_stride(image);
+    const unsigned char * data = cairo_image_surface_get_data(image);
+    vector<unsigned char> rgb(width * height * 3);
+    for (int y = 0; y < height; ++y)
+    {
+        auto * src = (const uint32_t *)(data + y * stride);
+        unsigned char * dst = rgb.data() + y * width * 3;
+        for (int x = 0; x < width; ++x)
+        {
+            dst[x * 3] = (src[x] >> 16) & 0xff;
+            dst[x * 3 + 1] = (src[x] >> 8) & 0xff;
+            dst[x * 3 + 2] = src[x] & 0xff;
+        }
+    }
+
+    FILE * f = fopen(filename.c_str(), "wb");
+    if (!f)
+        return false;
+
+    bool ok = false;
+    if (suffix == "webp")
+    {
+        ok = write_webp(f, width, height, rgb.data(), width * 3, param.bg_quality, param.bg_lossless, param.bg_effort);
+    }
+#ifdef ENABLE_LIBJPEG
+    else if (suffix == "jpg")
+    {
+        // use unique_ptr to auto delete the object
+        unique_ptr<ImgWriter> writer((param.bg_quality > 0) ? new JpegWriter(param.bg_quality, false) : new JpegWriter);
+        ok = writer->init(f, width, height, param.h_dpi, param.v_dpi);
+        for (int y = 0; ok && (y < height); ++y)
+        {
+            unsigned char * r = rgb.data() + y * width * 3;
+            ok = writer->writeRow(&r);
+        }
+        ok = ok && writer->close();
+    }
+#endif
+
+    fclose(f);
+    return ok;
 }
+
 // Override CairoOutputDev::setMimeData() and dump bitmaps in SVG to external files.
+// Bitmaps are named by the digest of their content, such that the same bitmap
+// used in different pages, or by different PDF objects, is written to the output only once.
 void CairoBackgroundRenderer::setMimeData(Stream *str, Object *ref, cairo_surface_t *image)
 {
     if (param.svg_embed_bitmap)
@@ -243,44 +544,83 @@ void CairoBackgroundRenderer::setMimeData(Stream *str, Object *ref, cairo_surfac
         return;
     }
 
-    // TODO dump bitmaps in other formats.
-    if (str->getKind() != strDCT)
+    if ((cairo_surface_get_type(image) != CAIRO_SURFACE_TYPE_IMAGE)
+        || ((cairo_image_surface_get_format(image) != CAIRO_FORMAT_RGB24)
+            && (cairo_image_surface_get_format(image) != CAIRO_FORMAT_ARGB32)))
         return;
 
-    // TODO inline image?
-    if (ref == nullptr || !ref->isRef())
-        return;
+    // The encoded data of JPEG streams is used as it is, see is_passthrough_jpeg().
+    // Streams without a ref are not read again, since they may be inline images.
+    string jpeg_data;
+    bool passthrough = (ref && ref->isRef() && is_passthrough_jpeg(str) && read_jpeg_stream(str, jpeg_data));
 
-    // We only dump rgb or gray jpeg without /Decode array.
-    //
-    // Although jpeg support CMYK, PDF readers do color conversion incompatibly with most other
-    // programs (including browsers): other programs invert CMYK color if 'Adobe' marker (app14) presents
-    // in a jpeg file; while PDF readers don't, they solely rely on /Decode array to invert color.
-    // It's a bit complicated to decide whether a CMYK jpeg is safe to dump, so we don't dump at all.
-    // See also:
-    //   JPEG file embedded in PDF (CMYK) https://forums.adobe.com/thread/975777
-    //   http://stackoverflow.com/questions/3123574/how-to-convert-from-cmyk-to-rgb-in-java-correctly
-    //
-    // In PDF, jpeg stream objects can also specify other color spaces like DeviceN and Separation,
-    // It is also not safe to dump them directly.
-    Object obj;
-    str->getDict()->lookup("ColorSpace", &obj);
-    if (!obj.isName() || (strcmp(obj.getName(), "DeviceRGB") && strcmp(obj.getName(), "DeviceGray")) )
+    unsigned long long hash = DIGEST_SEED;
+    string suffix;
+    if (passthrough)
     {
-        obj.free();
-        return;
+        hash = update_digest(hash, jpeg_data.data(), jpeg_data.size());
+        suffix = "jpg";
     }
-    obj.free();
-    str->getDict()->lookup("Decode", &obj);
-    if (obj.isArray())
+    else
     {
-        obj.free();
-        return;
+        cairo_surface_flush(image);
+        int header[3] = {
+            cairo_image_surface_get_width(image),
+            cairo_image_surface_get_height(image),
+            (int)cairo_image_surface_get_format(image)
+        };
+        hash = update_digest(hash, header, sizeof(header));
+        int stride = cairo_image_surface_get_stride(image);
+        const unsigned char * data = cairo_image_surface_get_data(image);
+        for (int y = 0; y < header[1]; ++y)
+            hash = update_digest(hash, data + y * stride, header[0] * 4);
+
+        // PNG is the only format keeping the alpha channel
+        suffix = (header[2] == CAIRO_FORMAT_ARGB32) ? "png" : param.svg_bitmap_format;
     }
-    obj.free();
 
-    int imgId = ref->getRef().num;
-    auto uri = strdup((char*) html_renderer->str_fmt("o%d.jpg", imgId));
+    auto write_bitmap = [&](const string & path) {
+        bool ok;
+        if (passthrough)
+        {
+            ofstream fout(path, ofstream::binary);
+            fout.write(jpeg_data.data(), jpeg_data.size());
+            ok = (bool)fout;
+        }
+        else
+        {
+            ok = dump_bitmap(image, suffix, path);
+        }
+        if (!ok)
+            throw string("Cannot write bitmap ") + path;
+    };
+
+    // The digest may collide, so an existing bitmap is compared before being reused,
+    // and a different bitmap with the same digest gets a numbered name.
+    string fn;
+    for (int i = 0; ; ++i)
+    {
+        // "o" for "PDF Object"
+        if (i == 0)
+            fn = (char*)html_renderer->str_fmt("o%016llx.%s", hash, suffix.c_str());
+        else
+            fn = (char*)html_renderer->str_fmt("o%016llx-%x.%s", hash, i, suffix.c_str());
+
+        if (bitmaps_ref_count.find(fn) == bitmaps_ref_count.end())
+        {
+            write_bitmap(build_bitmap_path(fn));
+            bitmaps_ref_count[fn] = 0;
+            break;
+        }
+
+        string tmp_path = param.tmp_dir + "/bitmap." + suffix;
+        html_renderer->tmp_files.add(tmp_path);
+        write_bitmap(tmp_path);
+        if (same_file_content(tmp_path, build_bitmap_path(fn)))
+            break;
+    }
+
+    auto uri = strdup(fn.c_str());
     auto st = cairo_surface_set_mime_data(image, CAIRO_MIME_TYPE_URI,
         (unsigned char*) uri, strlen(uri), free, uri);
     if (st)
@@ -288,21 +628,7 @@ void CairoBackgroundRenderer::setMimeData(Stream *str, Object *ref, cairo_surfac
         free(uri);
         return;
     }
-    bitmaps_in_current_page.push_back(imgId);
-
-    if(bitmaps_ref_count.find(imgId) != bitmaps_ref_count.end())
-        return;
-
-    bitmaps_ref_count[imgId] = 0;
-
-    char *strBuffer;
-    int len;
-    if (getStreamData(str->getNextStream(), &strBuffer, &len))
-    {
-        ofstream imgfile(build_bitmap_path(imgId), ofstream::binary);
-        imgfile.write(strBuffer, len);
-        free(strBuffer);
-    }
+    bitmaps_in_current_page.push_back(fn);
 }
 
 } // namespace pdf2htmlEX
@@ -15,6 +15,7 @@
 #include <unordered_map>
 #include <vector>
 #include <string>
+#include <fstream>
 
 #include "pdf2htmlEX-config.h"
 
@@ -44,6 +45,37 @@ public:
       double originX, double originY,
       CharCode code, int nBytes, Unicode *u, int uLen);
 
+  virtual void drawImage(GfxState * state, Object * ref, Stream * str,
+      int width, int height, GfxImageColorMap * colorMap,
+      GBool interpolate, int *maskColors, GBool inlineImg);
+
+  // for --svg-node-count-limit, count the drawing operations, each of which makes at least one node
+  // paths drawn with CSS are skipped, see HTMLRenderer::add_css_drawing()
+  virtual void stroke(GfxState *state);
+  virtual void fill(GfxState *state);
+  virtual void eoFill(GfxState *state);
+  virtual GBool axialShadedFill(GfxState *state, GfxAxialShading *shading, double tMin, double tMax);
+  virtual void clip(GfxState *state);
+  virtual void eoClip(GfxState *state);
+  virtual void drawImageMask(GfxState *state, Object *ref, Stream *str,
+      int width, int height, GBool invert,
+      GBool interpolate, GBool inlineImg);
+  virtual void drawMaskedImage(GfxState *state, Object *ref, Stream *str,
+      int width, int height,
+      GfxImageColorMap *colorMap,
+      GBool interpolate,
+      Stream *maskStr,
+      int maskWidth, int maskHeight,
+      GBool maskInvert, GBool maskInterpolate);
+  virtual void drawSoftMaskedImage(GfxState *state, Object *ref, Stream *str,
+      int width, int height,
+      GfxImageColorMap *colorMap,
+      GBool interpolate,
+      Stream *maskStr,
+      int maskWidth, int maskHeight,
+      GfxImageColorMap *maskColorMap,
+      GBool maskInterpolate);
+
   //for proof
   void beginTextObject(GfxState *state);
   void beginString(GfxState *state, GooString * str);
@@ -59,15 +91,38 @@ protected:
   cairo_surface_t * surface;
 
 private:
-  // convert bitmap stream id to bitmap file name. No pageno prefix,
+  // convert bitmap file name to its path. No pageno prefix,
   // because a bitmap may be shared by multiple pages.
-  std::string build_bitmap_path(int id);
-  // map<id_of_bitmap_stream, usage_count_in_all_svgs>
+  std::string build_bitmap_path(const std::string & filename);
+  // write the pixels of a bitmap in SVG as an image file, in the format of suffix
+  // return false on failure
+  bool dump_bitmap(cairo_surface_t * image, const std::string & suffix, const std::string & filename);
+  // map<bitmap_file_name, usage_count_in_all_svgs>
+  // bitmaps are named by the digest of their content, so identical bitmaps are shared.
   // note: if a svg bg fallbacks to bitmap bg, its bitmaps are not taken into account.
-  std::unordered_map<int, int> bitmaps_ref_count;
-  // id of bitmaps' stream used by current page
-  std::vector<int> bitmaps_in_current_page;
+  std::unordered_map<std::string, int> bitmaps_ref_count;
+  // file names of bitmaps used by current page
+  std::vector<std::string> bitmaps_in_current_page;
   int drawn_char_count;
+
+  // the SVG is written through write_svg(), into svg_data if buffer_svg(), or svg_file otherwise
+  // for --svg-node-count-limit, '<' are counted as the number of nodes
+  // cairo writes the document only when the surface is finished, so the count is known only after rendering
+  static cairo_status_t write_svg(void * renderer, const unsigned char * data, unsigned int length);
+  // passed to PDFDoc::displayPage() as the abort check callback
+  static GBool node_count_exceeded(void * renderer);
+  bool check_node_count() const { return param.svg_node_count_limit >= 0; }
+  // the SVG is kept in memory, to be embedded or post-processed
+  bool buffer_svg() const { return param.embed_image || param.svg_minify || param.svgz; }
+  // bg<pageno>.svg, or .svgz for --svgz
+  std::string get_svg_filename(int pageno);
+  std::ofstream svg_file;
+  std::string svg_data;
+  // drawing and clipping operations so far, each of which makes at least one node
+  // this is the only count available while rendering
+  int drawing_count;
+  // '<' written to svg_file
+  int node_count;
 };
 
 }
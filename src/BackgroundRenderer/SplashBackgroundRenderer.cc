@@ -5,17 +5,29 @@
  */
 
 #include <fstream>
+#include <sstream>
+#include <functional>
+#include <cmath>
 #include <vector>
 #include <memory>
+#include <climits>
+#include <cstdlib>
+#include <unordered_map>
+#include <cstring>
+#include <algorithm>
 
 #include <poppler-config.h>
 #include <PDFDoc.h>
+#include <Page.h>
+#include <Annot.h>
 #include <goo/ImgWriter.h>
 #include <goo/PNGWriter.h>
 #include <goo/JpegWriter.h>
 
 #include "Base64Stream.h"
 #include "util/const.h"
+#include "util/image.h"
+#include "util/math.h"
 
 #include "SplashBackgroundRenderer.h"
 
@@ -25,32 +37,71 @@ using std::string;
 using std::ifstream;
 using std::vector;
 using std::unique_ptr;
+using std::min;
+using std::max;
+using std::any_of;
+using std::abs;
 
 const SplashColor SplashBackgroundRenderer::white = {255,255,255};
+const SplashColor SplashBackgroundRenderer::transparent = {0,0,0};
 
-SplashBackgroundRenderer::SplashBackgroundRenderer(const string & imgFormat, HTMLRenderer * html_renderer, const Param & param)
-    : SplashOutputDev(splashModeRGB8, 4, gFalse, (SplashColorPtr)(&white))
+SplashBackgroundRenderer::SplashBackgroundRenderer(const string & imgFormat, HTMLRenderer * html_renderer, const Param & param,
+        SplashColorMode color_mode)
+    : SplashOutputDev(color_mode, 4, gFalse, (SplashColorPtr)(&white))
     , html_renderer(html_renderer)
     , param(param)
     , format(imgFormat)
+    , gray_image(false)
+    , is_gray_renderer(color_mode == splashModeMono8)
+    , use_gray_renderer(false)
+    , is_layer_renderer(false)
+    , cur_gfx(nullptr)
+    , cur_page(nullptr)
+    , cur_xref(nullptr)
+    , form_depth(0)
+    , soft_mask_active(false)
+    , layer_file_count(0)
 {
     bool supported = false;
 #ifdef ENABLE_LIBPNG
     if (format.empty())
         format = "png";
-    supported = supported || format == "png";
+    supported = supported || format == "png" || format == "auto";
 #endif
 #ifdef ENABLE_LIBJPEG
     if (format.empty())
         format = "jpg";
     supported = supported || format == "jpg";
+#endif
+#if ENABLE_WEBP
+    supported = supported || format == "webp";
+#endif
+#if ENABLE_AVIF
+    supported = supported || format == "avif";
 #endif
     if (!supported)
     {
         throw string("Image format not supported: ") + format;
     }
+
+    // for --bg-srcset, e.g. "1,1.5"
+    // embedded images have no srcset, so no copies are made for them
+    std::istringstream sin(param.embed_image ? "" : param.bg_srcset);
+    string density_str;
+    while(std::getline(sin, density_str, ','))
+    {
+        char * end = nullptr;
+        double density = strtod(density_str.c_str(), &end);
+        if((end == density_str.c_str()) || !(density > 0))
+            throw string("Invalid density for --bg-srcset: ") + density_str;
+        srcset_densities.push_back(density);
+    }
+    std::sort(srcset_densities.begin(), srcset_densities.end(), std::greater<double>());
 }
 
+SplashBackgroundRenderer::~SplashBackgroundRenderer()
+{ }
+
 /*
  * SplashOutputDev::startPage would paint the whole page with the background color
  * And thus have modified region set to the whole page area
@@ -60,6 +111,11 @@ void SplashBackgroundRenderer::startPage(int pageNum, GfxState *state, XRef *xre
 {
     SplashOutputDev::startPage(pageNum, state, xrefA);
     clearModRegion();
+    // layers are put on top of other content, so their edges must not be blended with the paper
+    if (is_layer_renderer)
+        getSplash()->clear((SplashColorPtr)transparent, 0);
+    cur_xref = xrefA;
+    soft_mask_active = false;
 }
 
 void SplashBackgroundRenderer::drawChar(GfxState *state, double x, double y,
@@ -70,12 +126,12 @@ void SplashBackgroundRenderer::drawChar(GfxState *state, double x, double y,
     // draw characters as image when
     // - in fallback mode
     // - OR there is special filling method
-    // - OR using a writing mode font
+    // - OR using a writing mode font while param.process_vertical_text is not enabled
     // - OR using a Type 3 font while param.process_type3 is not enabled
     // - OR the text is used as path
     if((param.fallback || param.proof)
        || ( (state->getFont()) 
-            && ( (state->getFont()->getWMode())
+            && ( (state->getFont()->getWMode() && (!param.process_vertical_text))
                  || ((state->getFont()->getType() == fontType3) && (!param.process_type3))
                  || (state->getRender() >= 4)
                )
@@ -86,13 +142,135 @@ void SplashBackgroundRenderer::drawChar(GfxState *state, double x, double y,
     }
     // If a char is treated as image, it is not subject to cover test
     // (see HTMLRenderer::drawString), so don't increase drawn_char_count.
-    else if (param.correct_text_visibility) {
+    // Layers are used only if no char is covered, see render_page().
+    else if (param.correct_text_visibility && !is_layer_renderer) {
         if (html_renderer->is_char_covered(drawn_char_count))
             SplashOutputDev::drawChar(state,x,y,dx,dy,originX,originY,code,nBytes,u,uLen);
         drawn_char_count++;
     }
 }
 
+void SplashBackgroundRenderer::drawImage(GfxState * state, Object * ref, Stream * str,
+        int width, int height, GfxImageColorMap * colorMap,
+        GBool interpolate, int *maskColors, GBool inlineImg)
+{
+    // Skip images extracted as separate elements, see HTMLRenderer::check_extracted_image()
+    if (param.extract_image && ref && ref->isRef() && (!inlineImg)
+        && is_drawn_in_html(get_image_key(ref->getRef(), state->getCTM(), getDefICTM()), true))
+        return;
+    SplashOutputDev::drawImage(state,ref,str,width,height,colorMap,interpolate,maskColors,inlineImg);
+}
+
+void SplashBackgroundRenderer::stroke(GfxState *state)
+{
+    if (param.css_draw && is_drawn_in_html(get_path_key(state, 's', getDefICTM()), false))
+        return;
+    SplashOutputDev::stroke(state);
+}
+
+void SplashBackgroundRenderer::fill(GfxState *state)
+{
+    if (param.css_draw && is_drawn_in_html(get_path_key(state, 'f', getDefICTM()), false))
+        return;
+    SplashOutputDev::fill(state);
+}
+
+void SplashBackgroundRenderer::eoFill(GfxState *state)
+{
+    if (param.css_draw && is_drawn_in_html(get_path_key(state, 'e', getDefICTM()), false))
+        return;
+    SplashOutputDev::eoFill(state);
+}
+
+GBool SplashBackgroundRenderer::axialShadedFill(GfxState *state, GfxAxialShading *shading, double tMin, double tMax)
+{
+    // drawn as a CSS gradient, see HTMLRenderer::add_css_gradient()
+    if (param.css_draw && is_drawn_in_html(get_shading_key(state, shading, getDefICTM()), false))
+        return gTrue;
+    return SplashOutputDev::axialShadedFill(state, shading, tMin, tMax);
+}
+
+/*
+ * Whether an image or a path is extracted or drawn with CSS in the page, such that it is skipped here
+ * Layers are shared by pages, where it might be drawn in HTML or not,
+ * so it is recorded in the layer, and checked for other pages in is_layer_usable()
+ * key: see get_image_key(), get_path_key() and get_shading_key()
+ */
+bool SplashBackgroundRenderer::is_drawn_in_html(const string & key, bool is_image)
+{
+    bool drawn = is_image ? html_renderer->is_image_extracted(key) : html_renderer->is_css_drawn(key);
+    if (is_layer_renderer)
+        layer_items.push_back(LayerItem{key, is_image, drawn});
+    return drawn;
+}
+
+bool SplashBackgroundRenderer::is_layer_usable(const Layer & layer)
+{
+    for (auto & item : layer.items)
+    {
+        bool drawn = item.is_image ? html_renderer->is_image_extracted(item.key) : html_renderer->is_css_drawn(item.key);
+        if (drawn != item.drawn_in_html)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Called for forms drawn in pages with shared forms, see display_page()
+ * A shared form is skipped, if it would look the same as in the layer,
+ * the region drawn before it is recorded to check the drawing order later.
+ */
+void SplashBackgroundRenderer::drawForm(Ref id)
+{
+    Object obj;
+    cur_xref->fetch(id.num, id.gen, &obj);
+    if (obj.isStream())
+    {
+        GfxState * state = cur_gfx->getState();
+        double m[6];
+        tm_multiply(m, getDefICTM(), state->getCTM());
+        string key = html_renderer->preprocessor.get_form_key(cur_page, id, m);
+
+        if (html_renderer->preprocessor.is_shared_form(key)
+            && Preprocessor::is_shareable_form(obj.streamGetDict())
+            && is_initial_state(state))
+        {
+            auto p = layers.insert(std::make_pair(key, Layer()));
+            auto & layer = p.first->second;
+            if (p.second)
+            {
+                layer.ref = id;
+                memcpy(layer.matrix, m, sizeof(m));
+                layer.rendered = false;
+            }
+
+            PageLayer page_layer;
+            page_layer.layer = &layer;
+            getModRegion(&page_layer.xmin, &page_layer.ymin, &page_layer.xmax, &page_layer.ymax);
+            page_layers.push_back(page_layer);
+            clearModRegion();
+        }
+        else
+        {
+            draw_form(cur_gfx, &obj, nullptr);
+        }
+    }
+    obj.free();
+}
+
+void SplashBackgroundRenderer::setSoftMask(GfxState *state, double *bbox, GBool alpha,
+        Function *transferFunc, GfxColor *backdropColor)
+{
+    soft_mask_active = true;
+    SplashOutputDev::setSoftMask(state, bbox, alpha, transferFunc, backdropColor);
+}
+
+void SplashBackgroundRenderer::clearSoftMask(GfxState *state)
+{
+    soft_mask_active = false;
+    SplashOutputDev::clearSoftMask(state);
+}
+
 void SplashBackgroundRenderer::beginTextObject(GfxState *state)
 {
     if (param.proof == 2)
@@ -130,8 +308,102 @@ static GBool annot_cb(Annot *, void * pflag) {
     return (*((bool*)pflag)) ? gTrue : gFalse;
 };
 
+static bool is_region_empty(int xmin, int ymin, int xmax, int ymax)
+{
+    return (xmin > xmax) || (ymin > ymax);
+}
+
+static bool region_intersect(int xmin1, int ymin1, int xmax1, int ymax1,
+        int xmin2, int ymin2, int xmax2, int ymax2)
+{
+    return !is_region_empty(xmin1, ymin1, xmax1, ymax1)
+        && !is_region_empty(xmin2, ymin2, xmax2, ymax2)
+        && (xmin1 <= xmax2) && (xmin2 <= xmax1)
+        && (ymin1 <= ymax2) && (ymin2 <= ymax1);
+}
+
+static void region_expand(int * region, int xmin, int ymin, int xmax, int ymax)
+{
+    if(is_region_empty(xmin, ymin, xmax, ymax))
+        return;
+    region[0] = min(region[0], xmin);
+    region[1] = min(region[1], ymin);
+    region[2] = max(region[2], xmax);
+    region[3] = max(region[3], ymax);
+}
+
 bool SplashBackgroundRenderer::render_page(PDFDoc * doc, int pageno)
 {
+    page_layers.clear();
+
+    bool use_layers = param.bg_shared_forms && html_renderer->preprocessor.has_shared_forms(pageno);
+
+    // Render the page with 1 byte per pixel, if nothing in it has colors
+    // Layers are shared by pages, which are not rendered by the same device
+    use_gray_renderer = param.bg_gray_render && !is_gray_renderer && !use_layers && html_renderer->page_gray;
+    if(use_gray_renderer)
+    {
+        if(!gray_renderer)
+        {
+            gray_renderer.reset(new SplashBackgroundRenderer(format, html_renderer, param, splashModeMono8));
+            gray_renderer->init(doc);
+        }
+        return gray_renderer->render_page(doc, pageno);
+    }
+
+    // Texts in shared forms are not counted in drawChar(), so covered texts cannot be handled
+    if(use_layers && param.correct_text_visibility)
+    {
+        const auto & chars_covered = html_renderer->covered_text_detector.get_chars_covered();
+        use_layers = !any_of(chars_covered.begin(), chars_covered.end(), [](bool b) { return b; });
+    }
+
+    if(use_layers)
+    {
+        drawn_char_count = 0;
+        display_page(doc, pageno);
+
+        // the region drawn after the last layer
+        PageLayer last;
+        getModRegion(&last.xmin, &last.ymin, &last.xmax, &last.ymax);
+
+        for(auto & page_layer : page_layers)
+        {
+            if(!page_layer.layer->rendered)
+                render_layer(doc, pageno, *page_layer.layer);
+        }
+
+        // layers are put on top of the background image,
+        // which is wrong if anything in the background is drawn over a layer after it,
+        // or if images or paths in a layer are drawn in HTML differently from the page where it is rendered
+        bool ok = true;
+        for(size_t i = 0; ok && (i < page_layers.size()); ++i)
+        {
+            const auto & layer = *page_layers[i].layer;
+            ok = is_layer_usable(layer);
+            if(!ok || layer.filename.empty())
+                continue;
+            for(size_t j = i + 1; ok && (j <= page_layers.size()); ++j)
+            {
+                const auto & r = (j < page_layers.size()) ? page_layers[j] : last;
+                ok = !region_intersect(layer.xmin, layer.ymin, layer.xmax, layer.ymax, r.xmin, r.ymin, r.xmax, r.ymax);
+            }
+        }
+
+        if(ok)
+        {
+            bg_region[0] = bg_region[1] = INT_MAX;
+            bg_region[2] = bg_region[3] = -1;
+            for(auto & r : page_layers)
+                region_expand(bg_region, r.xmin, r.ymin, r.xmax, r.ymax);
+            region_expand(bg_region, last.xmin, last.ymin, last.xmax, last.ymax);
+            return true;
+        }
+
+        // otherwise render the page again as usual
+        page_layers.clear();
+    }
+
     drawn_char_count = 0;
     bool process_annotation = param.process_annotation;
     doc->displayPage(this, pageno, param.h_dpi, param.v_dpi,
@@ -139,63 +411,789 @@ bool SplashBackgroundRenderer::render_page(PDFDoc * doc, int pageno)
             (!(param.use_cropbox)),
             false, false,
             nullptr, nullptr, &annot_cb, &process_annotation);
+    getModRegion(&bg_region[0], &bg_region[1], &bg_region[2], &bg_region[3]);
     return true;
 }
 
+/*
+ * Same as Page::displaySlice(), except that forms are drawn by drawForm()
+ */
+void SplashBackgroundRenderer::display_page(PDFDoc * doc, int pageno)
+{
+    cur_page = doc->getPage(pageno);
+    cur_gfx = cur_page->createGfx(this, param.h_dpi, param.v_dpi,
+            0,
+            (!(param.use_cropbox)),
+            false,
+            -1, -1, -1, -1,
+            false,
+            nullptr, nullptr);
+
+    Object contents;
+    cur_page->getContents(&contents);
+    if(!contents.isNull())
+    {
+        cur_gfx->saveState();
+        cur_gfx->display(&contents);
+        cur_gfx->restoreState();
+    }
+    contents.free();
+
+    if(param.process_annotation)
+    {
+        Annots * annots = cur_page->getAnnots();
+        for(int i = 0; i < annots->getNumAnnots(); ++i)
+            annots->getAnnot(i)->draw(cur_gfx, gFalse);
+    }
+
+    // endPage() is called by the destructor of Gfx
+    delete cur_gfx;
+    cur_gfx = nullptr;
+}
+
+void SplashBackgroundRenderer::draw_form(Gfx * gfx, Object * str, const double * extra_matrix)
+{
+    // same limit as Gfx
+    if(form_depth > 100)
+        return;
+
+    Dict * dict = str->streamGetDict();
+    Object obj1, obj2;
+
+    double bbox[4];
+    dict->lookup("BBox", &obj1);
+    if(!obj1.isArray() || (obj1.arrayGetLength() != 4))
+    {
+        obj1.free();
+        return;
+    }
+    for(int i = 0; i < 4; ++i)
+    {
+        obj1.arrayGet(i, &obj2);
+        bbox[i] = obj2.isNum() ? obj2.getNum() : 0;
+        obj2.free();
+    }
+    obj1.free();
+
+    double m[6] = { 1, 0, 0, 1, 0, 0 };
+    dict->lookup("Matrix", &obj1);
+    if(obj1.isArray() && (obj1.arrayGetLength() == 6))
+    {
+        for(int i = 0; i < 6; ++i)
+        {
+            obj1.arrayGet(i, &obj2);
+            if(obj2.isNum())
+                m[i] = obj2.getNum();
+            obj2.free();
+        }
+    }
+    obj1.free();
+
+    if(extra_matrix)
+    {
+        double form_matrix[6];
+        memcpy(form_matrix, m, sizeof(m));
+        tm_multiply(m, extra_matrix, form_matrix);
+    }
+
+    Object resources;
+    dict->lookup("Resources", &resources);
+    Dict * res_dict = resources.isDict() ? resources.getDict() : nullptr;
+
+    // the blending color space of the transparency group is ignored
+    bool transparency_group = false, isolated = false, knockout = false;
+    if(dict->lookup("Group", &obj1)->isDict())
+    {
+        if(obj1.dictLookup("S", &obj2)->isName("Transparency"))
+        {
+            transparency_group = true;
+            Object obj3;
+            if(obj1.dictLookup("I", &obj3)->isBool())
+                isolated = obj3.getBool();
+            obj3.free();
+            if(obj1.dictLookup("K", &obj3)->isBool())
+                knockout = obj3.getBool();
+            obj3.free();
+        }
+        obj2.free();
+    }
+    obj1.free();
+
+    ++ form_depth;
+    gfx->drawForm(str, res_dict, m, bbox,
+            (transparency_group ? gTrue : gFalse), gFalse, nullptr,
+            (isolated ? gTrue : gFalse), (knockout ? gTrue : gFalse));
+    -- form_depth;
+
+    resources.free();
+}
+
+bool SplashBackgroundRenderer::is_initial_state(GfxState * state)
+{
+    auto is_black = [](GfxColorSpace * cs, GfxColor * color) {
+        return (cs->getMode() == csDeviceGray) && (color->c[0] == 0);
+    };
+
+    if(!is_black(state->getFillColorSpace(), state->getFillColor())
+       || !is_black(state->getStrokeColorSpace(), state->getStrokeColor())
+       || !equal(state->getFillOpacity(), 1) || !equal(state->getStrokeOpacity(), 1)
+       || (state->getBlendMode() != gfxBlendNormal) || !equal(state->getLineWidth(), 1)
+       || soft_mask_active)
+        return false;
+
+    // line styles
+    double * dash;
+    int dash_length;
+    double dash_start;
+    state->getLineDash(&dash, &dash_length, &dash_start);
+    if((dash_length != 0) || (state->getLineCap() != 0) || (state->getLineJoin() != 0)
+       || !equal(state->getMiterLimit(), 10) || (state->getFlatness() != 1) || state->getStrokeAdjust())
+        return false;
+
+    // overprint, rendering intent and transfer functions
+    const char * rendering_intent = state->getRenderingIntent();
+    Function ** transfer = state->getTransfer();
+    if(state->getFillOverprint() || state->getStrokeOverprint() || (state->getOverprintMode() != 0)
+       || (rendering_intent && rendering_intent[0] && strcmp(rendering_intent, "RelativeColorimetric"))
+       || transfer[0] || transfer[1] || transfer[2] || transfer[3])
+        return false;
+
+    // text states, which are kept after text objects
+    if(state->getFont() || !equal(state->getCharSpace(), 0) || !equal(state->getWordSpace(), 0)
+       || !equal(state->getHorizScaling(), 1) || !equal(state->getLeading(), 0)
+       || !equal(state->getRise(), 0) || (state->getRender() != 0))
+        return false;
+
+    // not clipped inside the page
+    double xmin, ymin, xmax, ymax;
+    state->getClipBBox(&xmin, &ymin, &xmax, &ymax);
+    return (xmin <= 1) && (ymin <= 1)
+        && (xmax >= getBitmapWidth() - 1) && (ymax >= getBitmapHeight() - 1);
+}
+
+/*
+ * Render a form alone with the initial graphics state of the page, into a transparent image
+ * Images and paths drawn in HTML in this page are skipped, see is_drawn_in_html()
+ */
+void SplashBackgroundRenderer::render_layer(PDFDoc * doc, int pageno, Layer & layer)
+{
+    layer.rendered = true;
+
+    if(!layer_renderer)
+    {
+        layer_renderer.reset(new SplashBackgroundRenderer("png", html_renderer, param));
+        layer_renderer->is_layer_renderer = true;
+        layer_renderer->init(doc);
+    }
+    auto * dev = layer_renderer.get();
+    dev->layer_items.clear();
+
+    Gfx * gfx = doc->getPage(pageno)->createGfx(dev, param.h_dpi, param.v_dpi,
+            0,
+            (!(param.use_cropbox)),
+            false,
+            -1, -1, -1, -1,
+            false,
+            nullptr, nullptr);
+
+    Object obj;
+    doc->getXRef()->fetch(layer.ref.num, layer.ref.gen, &obj);
+    if(obj.isStream())
+        dev->draw_form(gfx, &obj, layer.matrix);
+    obj.free();
+
+    // endPage() is called by the destructor of Gfx
+    delete gfx;
+
+    layer.items.swap(dev->layer_items);
+    dev->getModRegion(&layer.xmin, &layer.ymin, &layer.xmax, &layer.ymax);
+    if(is_region_empty(layer.xmin, layer.ymin, layer.xmax, layer.ymax))
+        return;
+
+    // "l" for "Layer"
+    layer.filename = (char*)html_renderer->str_fmt("l%x.png", layer_file_count++);
+    string path = (param.embed_image ? param.tmp_dir : param.dest_dir) + "/" + layer.filename;
+    if(param.embed_image)
+        html_renderer->tmp_files.add(path);
+
+    dev->dump_layer_image(path.c_str(), layer.xmin, layer.ymin, layer.xmax, layer.ymax);
+}
+
+// bytes per pixel of a bitmap, which is either RGB8 or Mono8
+static int get_pixel_size(SplashBitmap * bitmap)
+{
+    return (bitmap->getMode() == splashModeMono8) ? 1 : 3;
+}
+
 void SplashBackgroundRenderer::embed_image(int pageno)
 {
+    if(use_gray_renderer)
+    {
+        gray_renderer->embed_image(pageno);
+        return;
+    }
+
     // xmin->xmax is top->bottom
-    int xmin, xmax, ymin, ymax;
-    getModRegion(&xmin, &ymin, &xmax, &ymax);
+    int xmin = bg_region[0], ymin = bg_region[1], xmax = bg_region[2], ymax = bg_region[3];
+
+    double h_scale = html_renderer->text_zoom_factor() * DEFAULT_DPI / param.h_dpi;
+    double v_scale = html_renderer->text_zoom_factor() * DEFAULT_DPI / param.v_dpi;
+
+    // for --bg-solid-min-size, rectangles of a single color are output as CSS boxes below the images,
+    // and they are removed from the bitmap, except where the images cover them anyway
+    auto * bitmap = getBitmap();
+    int pixel_size = get_pixel_size(bitmap);
+    int row_size = bitmap->getRowSize();
+    vector<int> solid_rects;
+    vector<unsigned> solid_colors;
+    vector<unsigned char> original_data;
+    if((param.bg_solid_min_size > 0) && !is_region_empty(xmin, ymin, xmax, ymax))
+        find_solid_rects(xmin, ymin, xmax, ymax, solid_rects, solid_colors);
+    if(!solid_rects.empty())
+    {
+        SplashColorPtr data = bitmap->getDataPtr();
+        original_data.assign(data, data + (size_t)row_size * bitmap->getHeight());
+        for(size_t i = 0; i < solid_rects.size(); i += 4)
+        {
+            for(int y = solid_rects[i + 1]; y <= solid_rects[i + 3]; ++y)
+            {
+                SplashColorPtr p = data + y * row_size + solid_rects[i] * pixel_size;
+                for(int x = solid_rects[i]; x <= solid_rects[i + 2]; ++x, p += pixel_size)
+                    memcpy(p, white, pixel_size);
+            }
+
+            html_renderer->dump_shape_element(*(html_renderer->f_curpage),
+                    ((double)solid_rects[i]) * h_scale,
+                    ((double)getBitmapHeight() - 1 - solid_rects[i + 3]) * v_scale,
+                    ((double)(solid_rects[i + 2] - solid_rects[i] + 1)) * h_scale,
+                    ((double)(solid_rects[i + 3] - solid_rects[i + 1] + 1)) * v_scale,
+                    (char*)html_renderer->str_fmt("#%06x", solid_colors[i / 4]));
+        }
+
+        // shrink the region to its non-blank part
+        while((ymin <= ymax) && is_blank(xmin, ymin, xmax, ymin)) ++ ymin;
+        while((ymin <= ymax) && is_blank(xmin, ymax, xmax, ymax)) -- ymax;
+        while((ymin <= ymax) && (xmin <= xmax) && is_blank(xmin, ymin, xmin, ymax)) ++ xmin;
+        while((ymin <= ymax) && (xmin <= xmax) && is_blank(xmax, ymin, xmax, ymax)) -- xmax;
+    }
 
     // dump the background image only when it is not empty
-    if((xmin <= xmax) && (ymin <= ymax))
+    if(!is_region_empty(xmin, ymin, xmax, ymax))
+    {
+        // x0, y0, x1, y1 of each image
+        vector<int> regions;
+        if(param.bg_tile_size > 0)
+            get_tiles(xmin, ymin, xmax, ymax, regions);
+        else
+            regions = { xmin, ymin, xmax, ymax };
+
+        // the images are opaque, so the original pixels are kept where they cover the solid rectangles
+        if(!original_data.empty())
+        {
+            SplashColorPtr data = bitmap->getDataPtr();
+            for(size_t i = 0; i < regions.size(); i += 4)
+            {
+                for(size_t j = 0; j < solid_rects.size(); j += 4)
+                {
+                    int x1 = max(regions[i], solid_rects[j]), x2 = min(regions[i + 2], solid_rects[j + 2]);
+                    int y1 = max(regions[i + 1], solid_rects[j + 1]), y2 = min(regions[i + 3], solid_rects[j + 3]);
+                    for(int y = y1; (x1 <= x2) && (y <= y2); ++y)
+                    {
+                        size_t offset = (size_t)y * row_size + x1 * pixel_size;
+                        memcpy(data + offset, original_data.data() + offset, (x2 - x1 + 1) * pixel_size);
+                    }
+                }
+            }
+        }
+
+        for(size_t i = 0; i < regions.size(); i += 4)
+        {
+            string img_format = choose_format(getBitmap(), regions[i], regions[i+1], regions[i+2], regions[i+3]);
+
+            string basename = (regions.size() == 4)
+                ? (char*)html_renderer->str_fmt("bg%x", pageno)
+                : (char*)html_renderer->str_fmt("bg%x_%x", pageno, (int)(i / 4));
+            string fn = basename + "." + img_format;
+
+            {
+                string path = (param.embed_image ? param.tmp_dir : param.dest_dir) + "/" + fn;
+                if(param.embed_image)
+                    html_renderer->tmp_files.add(path);
+
+                dump_image(path.c_str(), img_format, getBitmap(), regions[i], regions[i+1], regions[i+2], regions[i+3]);
+            }
+
+            // for --bg-srcset, pixels per CSS px of the image and its downscaled copies
+            vector<std::pair<string, double>> srcset;
+            if(!srcset_densities.empty())
+            {
+                double h_density = 1 / h_scale, v_density = 1 / v_scale;
+                srcset.push_back(std::make_pair(fn, h_density));
+                for(double density : srcset_densities)
+                {
+                    if(density >= h_density * 0.99)
+                        continue;
+                    string scaled_fn = dump_scaled_image(basename, density, density / h_density, density / v_density,
+                            regions[i], regions[i+1], regions[i+2], regions[i+3]);
+                    srcset.push_back(std::make_pair(scaled_fn, density));
+                }
+            }
+
+            html_renderer->dump_image_element(*(html_renderer->f_curpage), CSS::BACKGROUND_IMAGE_CN, fn,
+                    ((double)regions[i]) * h_scale,
+                    ((double)getBitmapHeight() - 1 - regions[i+3]) * v_scale,
+                    ((double)(regions[i+2] - regions[i] + 1)) * h_scale,
+                    ((double)(regions[i+3] - regions[i+1] + 1)) * v_scale,
+                    srcset);
+        }
+    }
+
+    // the whole page is still used by dump_thumbnail()
+    if(!original_data.empty())
+        memcpy(bitmap->getDataPtr(), original_data.data(), original_data.size());
+
+    // shared forms, in drawing order
+    vector<const Layer *> dumped_layers;
+    for(auto & page_layer : page_layers)
+    {
+        const auto & layer = *page_layer.layer;
+        if(layer.filename.empty()
+           || (std::find(dumped_layers.begin(), dumped_layers.end(), &layer) != dumped_layers.end()))
+            continue;
+        dumped_layers.push_back(&layer);
+
+        html_renderer->dump_image_element(*(html_renderer->f_curpage), CSS::BACKGROUND_IMAGE_CN, layer.filename,
+                ((double)layer.xmin) * h_scale,
+                ((double)getBitmapHeight() - 1 - layer.ymax) * v_scale,
+                ((double)(layer.xmax - layer.xmin + 1)) * h_scale,
+                ((double)(layer.ymax - layer.ymin + 1)) * v_scale);
+    }
+}
+
+/*
+ * Downscale the whole page bitmap to param.thumbnail_width,
+ * with the texts in HTML drawn as translucent boxes of their colors
+ */
+string SplashBackgroundRenderer::dump_thumbnail(int pageno)
+{
+    if(use_gray_renderer)
+        return gray_renderer->dump_thumbnail(pageno);
+
+    auto * bitmap = getBitmap();
+    int pixel_size = get_pixel_size(bitmap);
+    int width = min(param.thumbnail_width, bitmap->getWidth());
+    int height = max(1, (int)std::round((double)bitmap->getHeight() * width / bitmap->getWidth()));
+
+    unique_ptr<SplashBitmap> thumbnail(new SplashBitmap(width, height, 1, bitmap->getMode(), gFalse));
+    SplashColorPtr data = thumbnail->getDataPtr();
+    int row_size = thumbnail->getRowSize();
+    downscale_image(bitmap->getDataPtr(), bitmap->getWidth(), bitmap->getHeight(), bitmap->getRowSize(),
+            data, width, height, row_size, pixel_size);
+
+    // HTML units -> pixels of the thumbnail, where y is top->bottom
+    double h_scale = (double)width / bitmap->getWidth() * param.h_dpi / (html_renderer->text_zoom_factor() * DEFAULT_DPI);
+    double v_scale = (double)height / bitmap->getHeight() * param.v_dpi / (html_renderer->text_zoom_factor() * DEFAULT_DPI);
+    for(const auto & text : html_renderer->thumbnail_texts)
     {
+        int x1 = max(0, (int)std::floor(text.bbox[0] * h_scale));
+        int x2 = min(width - 1, (int)std::ceil(text.bbox[2] * h_scale) - 1);
+        int y1 = max(0, height - (int)std::ceil(text.bbox[3] * v_scale));
+        int y2 = min(height - 1, height - 1 - (int)std::floor(text.bbox[1] * v_scale));
+
+        unsigned char color[3] = {
+            (unsigned char)((text.color >> 16) & 0xff),
+            (unsigned char)((text.color >> 8) & 0xff),
+            (unsigned char)(text.color & 0xff)
+        };
+        if(pixel_size == 1)
+            color[0] = (unsigned char)((color[0] * 77 + color[1] * 151 + color[2] * 28) >> 8);
+
+        for(int y = y1; y <= y2; ++y)
         {
-            auto fn = html_renderer->str_fmt("%s/bg%x.%s", (param.embed_image ? param.tmp_dir : param.dest_dir).c_str(), pageno, format.c_str());
-            if(param.embed_image)
-                html_renderer->tmp_files.add((char*)fn);
+            SplashColorPtr p = data + y * row_size + x1 * pixel_size;
+            for(int x = x1; x <= x2; ++x, p += pixel_size)
+            {
+                for(int i = 0; i < pixel_size; ++i)
+                    p[i] = (p[i] + color[i]) / 2;
+            }
+        }
+    }
+
+    string img_format = choose_format(thumbnail.get(), 0, 0, width - 1, height - 1);
+    string fn = (char*)html_renderer->str_fmt("thumb%x.%s", pageno, img_format.c_str());
+    dump_image((param.dest_dir + "/" + fn).c_str(), img_format, thumbnail.get(), 0, 0, width - 1, height - 1);
+    return fn;
+}
+
+/*
+ * Downscale a region of the page bitmap, and dump it as <basename>-<density>x.<format>
+ * Return the filename
+ */
+string SplashBackgroundRenderer::dump_scaled_image(const string & basename, double density, double h_scale, double v_scale,
+        int x1, int y1, int x2, int y2)
+{
+    auto * bitmap = getBitmap();
+    int pixel_size = get_pixel_size(bitmap);
+    int width = x2 - x1 + 1;
+    int height = y2 - y1 + 1;
+    int scaled_width = max(1, (int)std::round(width * h_scale));
+    int scaled_height = max(1, (int)std::round(height * v_scale));
+
+    unique_ptr<SplashBitmap> scaled_bitmap(new SplashBitmap(scaled_width, scaled_height, 1, bitmap->getMode(), gFalse));
+    downscale_image(bitmap->getDataPtr() + y1 * bitmap->getRowSize() + x1 * pixel_size, width, height, bitmap->getRowSize(),
+            scaled_bitmap->getDataPtr(), scaled_width, scaled_height, scaled_bitmap->getRowSize(), pixel_size);
+
+    string img_format = choose_format(scaled_bitmap.get(), 0, 0, scaled_width - 1, scaled_height - 1);
+    string fn = basename + (char*)html_renderer->str_fmt("-%gx.", density) + img_format;
+    dump_image((param.dest_dir + "/" + fn).c_str(), img_format, scaled_bitmap.get(), 0, 0, scaled_width - 1, scaled_height - 1);
+    return fn;
+}
+
+// 0xRRGGBB
+static inline unsigned get_color(SplashColorPtr p, int pixel_size)
+{
+    return (pixel_size == 1)
+        ? ((p[0] << 16) | (p[0] << 8) | p[0])
+        : ((p[0] << 16) | (p[1] << 8) | p[2]);
+}
 
-            dump_image((char*)fn, xmin, ymin, xmax, ymax);
+bool SplashBackgroundRenderer::is_blank(int x1, int y1, int x2, int y2)
+{
+    return is_solid(x1, y1, x2, y2, get_color((SplashColorPtr)white, 3));
+}
+
+bool SplashBackgroundRenderer::is_solid(int x1, int y1, int x2, int y2, unsigned color)
+{
+    auto * bitmap = getBitmap();
+    SplashColorPtr data = bitmap->getDataPtr();
+    int row_size = bitmap->getRowSize();
+    int pixel_size = get_pixel_size(bitmap);
+    for(int y = y1; y <= y2; ++y)
+    {
+        SplashColorPtr p = data + y * row_size + x1 * pixel_size;
+        for(int x = x1; x <= x2; ++x, p += pixel_size)
+        {
+            if(get_color(p, pixel_size) != color)
+                return false;
         }
+    }
+    return true;
+}
 
-        double h_scale = html_renderer->text_zoom_factor() * DEFAULT_DPI / param.h_dpi;
-        double v_scale = html_renderer->text_zoom_factor() * DEFAULT_DPI / param.v_dpi;
+/*
+ * The region is divided into small blocks, and adjacent blocks of the same color are merged into rectangles,
+ * first in a row and then down the rows. Each rectangle is then extended to the exact edges of the color.
+ */
+void SplashBackgroundRenderer::find_solid_rects(int xmin, int ymin, int xmax, int ymax,
+        vector<int> & rects, vector<unsigned> & colors)
+{
+    const int block_size = 8;
+    auto * bitmap = getBitmap();
+    SplashColorPtr data = bitmap->getDataPtr();
+    int row_size = bitmap->getRowSize();
+    int pixel_size = get_pixel_size(bitmap);
+    unsigned paper_color = get_color((SplashColorPtr)white, 3);
 
-        auto & f_page = *(html_renderer->f_curpage);
-        auto & all_manager = html_renderer->all_manager;
-        
-        f_page << "<img class=\"" << CSS::BACKGROUND_IMAGE_CN 
-            << " " << CSS::LEFT_CN      << all_manager.left.install(((double)xmin) * h_scale)
-            << " " << CSS::BOTTOM_CN    << all_manager.bottom.install(((double)getBitmapHeight() - 1 - ymax) * v_scale)
-            << " " << CSS::WIDTH_CN     << all_manager.width.install(((double)(xmax - xmin + 1)) * h_scale)
-            << " " << CSS::HEIGHT_CN    << all_manager.height.install(((double)(ymax - ymin + 1)) * v_scale)
-            << "\" alt=\"\" src=\"";
+    int cols = (xmax - xmin) / block_size + 1;
+    int rows = (ymax - ymin) / block_size + 1;
+    // color of each block, or -1 if it has more than one color, or it is blank
+    vector<long long> block_colors(cols * rows, -1);
+    for(int row = 0; row < rows; ++row)
+    {
+        int y1 = ymin + row * block_size, y2 = min(y1 + block_size - 1, ymax);
+        for(int col = 0; col < cols; ++col)
+        {
+            int x1 = xmin + col * block_size, x2 = min(x1 + block_size - 1, xmax);
+            unsigned color = get_color(data + y1 * row_size + x1 * pixel_size, pixel_size);
+            if((color != paper_color) && is_solid(x1, y1, x2, y2, color))
+                block_colors[row * cols + col] = color;
+        }
+    }
 
-        if(param.embed_image)
+    rects.clear();
+    colors.clear();
+    for(int row = 0; row < rows; ++row)
+    {
+        for(int col = 0; col < cols; ++col)
         {
-            auto path = html_renderer->str_fmt("%s/bg%x.%s", param.tmp_dir.c_str(), pageno, format.c_str());
-            ifstream fin((char*)path, ifstream::binary);
-            if(!fin)
-                throw string("Cannot read background image ") + (char*)path;
+            long long color = block_colors[row * cols + col];
+            if(color < 0)
+                continue;
 
-            auto iter = FORMAT_MIME_TYPE_MAP.find(format);
-            if(iter == FORMAT_MIME_TYPE_MAP.end())
-                throw string("Image format not supported: ") + format;
+            int col2 = col;
+            while((col2 + 1 < cols) && (block_colors[row * cols + col2 + 1] == color))
+                ++ col2;
+            int row2 = row;
+            while(row2 + 1 < rows)
+            {
+                bool same = true;
+                for(int c = col; same && (c <= col2); ++c)
+                    same = (block_colors[(row2 + 1) * cols + c] == color);
+                if(!same)
+                    break;
+                ++ row2;
+            }
+            for(int r = row; r <= row2; ++r)
+                std::fill(block_colors.begin() + r * cols + col, block_colors.begin() + r * cols + col2 + 1, -1);
 
-            string mime_type = iter->second;
-            f_page << "data:" << mime_type << ";base64," << Base64Stream(fin);
+            int x1 = xmin + col * block_size, x2 = min(xmin + (col2 + 1) * block_size - 1, xmax);
+            int y1 = ymin + row * block_size, y2 = min(ymin + (row2 + 1) * block_size - 1, ymax);
+            while((x1 > xmin) && is_solid(x1 - 1, y1, x1 - 1, y2, color)) -- x1;
+            while((x2 < xmax) && is_solid(x2 + 1, y1, x2 + 1, y2, color)) ++ x2;
+            while((y1 > ymin) && is_solid(x1, y1 - 1, x2, y1 - 1, color)) -- y1;
+            while((y2 < ymax) && is_solid(x1, y2 + 1, x2, y2 + 1, color)) ++ y2;
+
+            if((x2 - x1 + 1 >= param.bg_solid_min_size) && (y2 - y1 + 1 >= param.bg_solid_min_size))
+            {
+                rects.insert(rects.end(), { x1, y1, x2, y2 });
+                colors.push_back((unsigned)color);
+            }
         }
-        else
+    }
+}
+
+/*
+ * Split the region into tiles of param.bg_tile_size, and keep the non-blank ones
+ * Adjacent tiles in a row are merged, so are those with the same columns in adjacent rows
+ * Each merged region is then shrunk to its non-blank part
+ */
+void SplashBackgroundRenderer::get_tiles(int xmin, int ymin, int xmax, int ymax, vector<int> & regions)
+{
+    int tile_size = param.bg_tile_size;
+    int col0 = xmin / tile_size, col1 = xmax / tile_size;
+    int row0 = ymin / tile_size, row1 = ymax / tile_size;
+
+    // merged tiles: col0, row0, col1, row1
+    vector<int> tiles;
+    for(int row = row0; row <= row1; ++row)
+    {
+        int y1 = max(row * tile_size, ymin);
+        int y2 = min((row + 1) * tile_size - 1, ymax);
+        for(int col = col0; col <= col1; ++col)
+        {
+            int x1 = max(col * tile_size, xmin);
+            int x2 = min((col + 1) * tile_size - 1, xmax);
+            if(is_blank(x1, y1, x2, y2))
+                continue;
+
+            // extend the last tile in this row
+            if(!tiles.empty() && (tiles[tiles.size() - 1] == row) && (tiles[tiles.size() - 2] == col - 1))
+            {
+                tiles[tiles.size() - 2] = col;
+                continue;
+            }
+            tiles.insert(tiles.end(), { col, row, col, row });
+        }
+
+        // merge runs of this row into those of the previous row with the same columns
+        size_t i = tiles.size();
+        while((i >= 4) && (tiles[i - 1] == row))
+            i -= 4;
+        for(size_t j = i; j < tiles.size(); )
         {
-            f_page << (char*)html_renderer->str_fmt("bg%x.%s", pageno, format.c_str());
+            bool merged = false;
+            for(size_t k = 0; k < i; k += 4)
+            {
+                if((tiles[k + 3] == row - 1) && (tiles[k] == tiles[j]) && (tiles[k + 2] == tiles[j + 2]))
+                {
+                    tiles[k + 3] = row;
+                    tiles.erase(tiles.begin() + j, tiles.begin() + j + 4);
+                    merged = true;
+                    break;
+                }
+            }
+            if(!merged)
+                j += 4;
+        }
+    }
+
+    regions.clear();
+    for(size_t i = 0; i < tiles.size(); i += 4)
+    {
+        int x1 = max(tiles[i] * tile_size, xmin);
+        int y1 = max(tiles[i + 1] * tile_size, ymin);
+        int x2 = min((tiles[i + 2] + 1) * tile_size - 1, xmax);
+        int y2 = min((tiles[i + 3] + 1) * tile_size - 1, ymax);
+
+        while(is_blank(x1, y1, x2, y1)) ++ y1;
+        while(is_blank(x1, y2, x2, y2)) -- y2;
+        while(is_blank(x1, y1, x1, y2)) ++ x1;
+        while(is_blank(x2, y1, x2, y2)) -- x2;
+
+        regions.insert(regions.end(), { x1, y1, x2, y2 });
+    }
+}
+
+/*
+ * Other formats are used as they are
+ * For PNG (--bg-format png or auto), an image is written as
+ * - palette PNG, if there are at most 16 colors, such that pixels are packed into less than 8 bits
+ * - palette PNG, if there are at most 256 colors and some pixels are not gray
+ * - JPEG, if --bg-format is auto and the image looks like a photo, which has many smooth color changes and few sharp edges
+ * - grayscale PNG, if all pixels are gray
+ * - palette PNG, if --bg-quantize is on
+ * - truecolor PNG
+ */
+string SplashBackgroundRenderer::choose_format(SplashBitmap * bitmap, int x1, int y1, int x2, int y2)
+{
+    palette.clear();
+    quantize_map.clear();
+    gray_image = false;
+
+    if((format != "png") && (format != "auto"))
+        return format;
+
+    SplashColorPtr data = bitmap->getDataPtr();
+    int row_size = bitmap->getRowSize();
+    int pixel_size = get_pixel_size(bitmap);
+
+    // map<color, index in the palette>
+    std::unordered_map<unsigned, int> colors;
+    bool too_many_colors = false;
+    bool gray = true;
+    // pairs of horizontally adjacent pixels with different colors
+    long long changes = 0, smooth_changes = 0, sharp_changes = 0;
+
+    for(int y = y1; y <= y2; ++y)
+    {
+        SplashColorPtr p = data + y * row_size + x1 * pixel_size;
+        unsigned last_color = 0;
+        for(int x = x1; x <= x2; ++x, p += pixel_size)
+        {
+            unsigned color = get_color(p, pixel_size);
+            if(x > x1)
+            {
+                if(color == last_color)
+                    continue;
+
+                int d = abs((int)(color >> 16) - (int)(last_color >> 16))
+                    + abs((int)((color >> 8) & 0xff) - (int)((last_color >> 8) & 0xff))
+                    + abs((int)(color & 0xff) - (int)(last_color & 0xff));
+                ++ changes;
+                if(d <= 24)
+                    ++ smooth_changes;
+                else if(d >= 128)
+                    ++ sharp_changes;
+            }
+            last_color = color;
+
+            if(gray && (((color >> 16) != (color & 0xff)) || (((color >> 8) & 0xff) != (color & 0xff))))
+                gray = false;
+
+            if(!too_many_colors && !colors.count(color))
+            {
+                if(colors.size() >= 256)
+                    too_many_colors = true;
+                else
+                    colors.insert(std::make_pair(color, (int)colors.size()));
+            }
+        }
+    }
+
+#if ENABLE_PALETTE_PNG
+    if(!too_many_colors && ((colors.size() <= 16) || !gray))
+    {
+        palette.resize(colors.size());
+        for(auto & c : colors)
+            palette[c.second] = c.first;
+        return "png";
+    }
+#endif
+
+#ifdef ENABLE_LIBJPEG
+    if((format == "auto") && (smooth_changes * 4 > changes) && (sharp_changes * 20 < smooth_changes))
+        return "jpg";
+#endif
+
+    if(gray)
+    {
+        gray_image = true;
+        return "png";
+    }
+
+#if ENABLE_PALETTE_PNG
+    if(param.bg_quantize)
+        quantize(bitmap, x1, y1, x2, y2);
+#endif
+
+    return "png";
+}
+
+/*
+ * Reduce the colors to 256, using the popular colors in a 5-5-5 bit RGB histogram
+ */
+void SplashBackgroundRenderer::quantize(SplashBitmap * bitmap, int x1, int y1, int x2, int y2)
+{
+    const int bin_count = 1 << 15;
+    auto get_bin = [](unsigned color) {
+        return (int)(((color >> 9) & 0x7c00) | ((color >> 6) & 0x3e0) | ((color >> 3) & 0x1f));
+    };
+
+    SplashColorPtr data = bitmap->getDataPtr();
+    int row_size = bitmap->getRowSize();
+    int pixel_size = get_pixel_size(bitmap);
+
+    // count and sum of r, g, b of each bin
+    vector<long long> stats(bin_count * 4, 0);
+    for(int y = y1; y <= y2; ++y)
+    {
+        SplashColorPtr p = data + y * row_size + x1 * pixel_size;
+        for(int x = x1; x <= x2; ++x, p += pixel_size)
+        {
+            unsigned color = get_color(p, pixel_size);
+            long long * stat = &stats[get_bin(color) * 4];
+            stat[0] += 1;
+            stat[1] += (color >> 16);
+            stat[2] += (color >> 8) & 0xff;
+            stat[3] += color & 0xff;
+        }
+    }
+
+    vector<int> bins;
+    for(int i = 0; i < bin_count; ++i)
+    {
+        if(stats[i * 4] > 0)
+            bins.push_back(i);
+    }
+    size_t palette_size = min<size_t>(bins.size(), 256);
+    std::partial_sort(bins.begin(), bins.begin() + palette_size, bins.end(),
+            [&stats](int b1, int b2) { return stats[b1 * 4] > stats[b2 * 4]; });
+
+    // the average color of each popular bin
+    palette.resize(palette_size);
+    for(size_t i = 0; i < palette_size; ++i)
+    {
+        const long long * stat = &stats[bins[i] * 4];
+        palette[i] = ((unsigned)(stat[1] / stat[0]) << 16)
+            | ((unsigned)(stat[2] / stat[0]) << 8)
+            | (unsigned)(stat[3] / stat[0]);
+    }
+
+    // map each used bin to the nearest color in the palette
+    quantize_map.assign(bin_count, 0);
+    for(int bin : bins)
+    {
+        const long long * stat = &stats[bin * 4];
+        int r = stat[1] / stat[0], g = stat[2] / stat[0], b = stat[3] / stat[0];
+        int best_distance = INT_MAX;
+        for(size_t i = 0; i < palette_size; ++i)
+        {
+            int dr = r - (int)(palette[i] >> 16);
+            int dg = g - (int)((palette[i] >> 8) & 0xff);
+            int db = b - (int)(palette[i] & 0xff);
+            int distance = dr * dr + dg * dg + db * db;
+            if(distance < best_distance)
+            {
+                best_distance = distance;
+                quantize_map[bin] = (unsigned char)i;
+            }
         }
-        f_page << "\"/>";
     }
 }
 
 // There might be mem leak when exception is thrown !
-void SplashBackgroundRenderer::dump_image(const char * filename, int x1, int y1, int x2, int y2)
+void SplashBackgroundRenderer::dump_image(const char * filename, const string & img_format, SplashBitmap * bitmap,
+        int x1, int y1, int x2, int y2)
 {
     int width = x2 - x1 + 1;
     int height = y2 - y1 + 1;
@@ -206,48 +1204,150 @@ void SplashBackgroundRenderer::dump_image(const char * filename, int x1, int y1,
     if(!f)
         throw string("Cannot open file for background image " ) + filename;
 
+    assert((bitmap->getMode() == splashModeRGB8) || (bitmap->getMode() == splashModeMono8));
+
+    SplashColorPtr data = bitmap->getDataPtr();
+    int row_size = bitmap->getRowSize();
+    int pixel_size = get_pixel_size(bitmap);
+
+    if((img_format == "webp") || (img_format == "avif"))
+    {
+        // the encoders take the whole image in RGB
+        const unsigned char * rgb = data + y1 * row_size + x1 * pixel_size;
+        int stride = row_size;
+        vector<unsigned char> buf;
+        if(pixel_size != 3)
+        {
+            buf.resize(width * height * 3);
+            for(int y = 0; y < height; ++y)
+            {
+                SplashColorPtr p = data + (y1 + y) * row_size + x1 * pixel_size;
+                unsigned char * q = buf.data() + y * width * 3;
+                for(int x = 0; x < width; ++x, p += pixel_size, q += 3)
+                    q[0] = q[1] = q[2] = p[0];
+            }
+            rgb = buf.data();
+            stride = width * 3;
+        }
+
+        bool ok = (img_format == "webp")
+            ? write_webp(f, width, height, rgb, stride, param.bg_quality, param.bg_lossless, param.bg_effort)
+            : write_avif(f, width, height, rgb, stride, param.bg_quality, param.bg_lossless, param.bg_effort);
+        if(!ok)
+            throw "Cannot write background image";
+
+        fclose(f);
+        return;
+    }
+
+    if((img_format == "png") && !palette.empty())
+    {
+        std::unordered_map<unsigned, unsigned char> indices;
+        vector<unsigned char> colors(palette.size() * 3);
+        for(size_t i = 0; i < palette.size(); ++i)
+        {
+            indices[palette[i]] = (unsigned char)i;
+            colors[i * 3] = (palette[i] >> 16) & 0xff;
+            colors[i * 3 + 1] = (palette[i] >> 8) & 0xff;
+            colors[i * 3 + 2] = palette[i] & 0xff;
+        }
+
+        vector<unsigned char> image(width * height);
+        vector<unsigned char*> rows;
+        rows.reserve(height);
+        for(int y = 0; y < height; ++y)
+        {
+            SplashColorPtr p = data + (y1 + y) * row_size + x1 * pixel_size;
+            unsigned char * row = image.data() + y * width;
+            for(int x = 0; x < width; ++x, p += pixel_size)
+            {
+                unsigned color = get_color(p, pixel_size);
+                if(quantize_map.empty())
+                    row[x] = indices[color];
+                else
+                    row[x] = quantize_map[((color >> 9) & 0x7c00) | ((color >> 6) & 0x3e0) | ((color >> 3) & 0x1f)];
+            }
+            rows.push_back(row);
+        }
+
+        if(!write_palette_png(f, width, height, colors.data(), palette.size(), rows.data(), param.h_dpi, param.v_dpi))
+            throw "Cannot write background image";
+
+        fclose(f);
+        return;
+    }
+
     // use unique_ptr to auto delete the object upon exception
     unique_ptr<ImgWriter> writer;
 
     if(false) { }
 #ifdef ENABLE_LIBPNG
-    else if(format == "png")
+    else if((img_format == "png") && gray_image)
+    {
+        writer = unique_ptr<ImgWriter>(new PNGWriter(PNGWriter::GRAY));
+    }
+    else if(img_format == "png")
     {
         writer = unique_ptr<ImgWriter>(new PNGWriter);
     }
 #endif
 #ifdef ENABLE_LIBJPEG
-    else if(format == "jpg")
+    else if(img_format == "jpg")
     {
-        writer = unique_ptr<ImgWriter>(new JpegWriter);
+        if(param.bg_quality > 0)
+            writer = unique_ptr<ImgWriter>(new JpegWriter(param.bg_quality, false));
+        else
+            writer = unique_ptr<ImgWriter>(new JpegWriter);
     }
 #endif
     else
     {
-        throw string("Image format not supported: ") + format;
+        throw string("Image format not supported: ") + img_format;
     }
 
     if(!writer->init(f, width, height, param.h_dpi, param.v_dpi))
         throw "Cannot initialize image writer";
-        
-    auto * bitmap = getBitmap();
-    assert(bitmap->getMode() == splashModeRGB8);
-
-    SplashColorPtr data = bitmap->getDataPtr();
-    int row_size = bitmap->getRowSize();
 
-    vector<unsigned char*> pointers;
-    pointers.reserve(height);
-    SplashColorPtr p = data + y1 * row_size + x1 * 3;
-    for(int i = 0; i < height; ++i)
+    // the bitmap can be used directly if the pixel formats are the same,
+    // otherwise convert the pixels row by row
+    int out_pixel_size = ((img_format == "png") && gray_image) ? 1 : 3;
+    if(out_pixel_size == pixel_size)
     {
-        pointers.push_back(p);
-        p += row_size;
+        vector<unsigned char*> pointers;
+        pointers.reserve(height);
+        SplashColorPtr p = data + y1 * row_size + x1 * pixel_size;
+        for(int i = 0; i < height; ++i)
+        {
+            pointers.push_back(p);
+            p += row_size;
+        }
+
+        if(!writer->writePointers(pointers.data(), height)) 
+        {
+            throw "Cannot write background image";
+        }
     }
-    
-    if(!writer->writePointers(pointers.data(), height)) 
+    else
     {
-        throw "Cannot write background image";
+        vector<unsigned char> row(width * out_pixel_size);
+        for(int y = y1; y <= y2; ++y)
+        {
+            SplashColorPtr p = data + y * row_size + x1 * pixel_size;
+            for(int x = 0; x < width; ++x, p += pixel_size)
+            {
+                if(out_pixel_size == 1)
+                {
+                    row[x] = p[0];
+                }
+                else
+                {
+                    row[x * 3] = row[x * 3 + 1] = row[x * 3 + 2] = p[0];
+                }
+            }
+            unsigned char * r = row.data();
+            if(!writer->writeRow(&r))
+                throw "Cannot write background image";
+        }
     }
 
     if(!writer->close())
@@ -258,4 +1358,55 @@ void SplashBackgroundRenderer::dump_image(const char * filename, int x1, int y1,
     fclose(f);
 }
 
+void SplashBackgroundRenderer::dump_layer_image(const char * filename, int x1, int y1, int x2, int y2)
+{
+#ifdef ENABLE_LIBPNG
+    int width = x2 - x1 + 1;
+    int height = y2 - y1 + 1;
+    if((width <= 0) || (height <= 0))
+        throw "Bad metric for layer image";
+
+    FILE * f = fopen(filename, "wb");
+    if(!f)
+        throw string("Cannot open file for layer image " ) + filename;
+
+    // use unique_ptr to auto delete the object upon exception
+    unique_ptr<ImgWriter> writer(new PNGWriter(PNGWriter::RGBA));
+    if(!writer->init(f, width, height, param.h_dpi, param.v_dpi))
+        throw "Cannot initialize image writer";
+
+    auto * bitmap = getBitmap();
+    assert(bitmap->getMode() == splashModeRGB8);
+
+    SplashColorPtr data = bitmap->getDataPtr();
+    Guchar * alpha = bitmap->getAlphaPtr();
+    int row_size = bitmap->getRowSize();
+    int bitmap_width = bitmap->getWidth();
+
+    vector<unsigned char> row(width * 4);
+    for(int y = y1; y <= y2; ++y)
+    {
+        SplashColorPtr p = data + y * row_size + x1 * 3;
+        Guchar * a = alpha ? (alpha + y * bitmap_width + x1) : nullptr;
+        for(int x = 0; x < width; ++x)
+        {
+            row[x * 4] = p[x * 3];
+            row[x * 4 + 1] = p[x * 3 + 1];
+            row[x * 4 + 2] = p[x * 3 + 2];
+            row[x * 4 + 3] = a ? a[x] : 255;
+        }
+        unsigned char * r = row.data();
+        if(!writer->writeRow(&r))
+            throw "Cannot write layer image";
+    }
+
+    if(!writer->close())
+        throw "Cannot finish layer image";
+
+    fclose(f);
+#else
+    throw "PNG is not supported";
+#endif
+}
+
 } // namespace pdf2htmlEX
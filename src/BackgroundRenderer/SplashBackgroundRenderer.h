@@ -10,9 +10,13 @@
 #define SPLASH_BACKGROUND_RENDERER_H__
 
 #include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
 
 #include <splash/SplashBitmap.h>
 #include <SplashOutputDev.h>
+#include <Gfx.h>
 
 #include "pdf2htmlEX-config.h"
 
@@ -26,14 +30,19 @@ class SplashBackgroundRenderer : public BackgroundRenderer, SplashOutputDev
 {
 public:
   static const SplashColor white;
-  //format: "png" or "jpg", or "" for a default format
-  SplashBackgroundRenderer(const std::string & format, HTMLRenderer * html_renderer, const Param & param);
+  // the paper color of layers, with alpha 0
+  static const SplashColor transparent;
+  //format: "png", "jpg", "webp", "avif" or "auto", or "" for a default format
+  //color_mode: splashModeRGB8 or splashModeMono8
+  SplashBackgroundRenderer(const std::string & format, HTMLRenderer * html_renderer, const Param & param,
+          SplashColorMode color_mode = splashModeRGB8);
 
-  virtual ~SplashBackgroundRenderer() { }
+  virtual ~SplashBackgroundRenderer();
 
   virtual void init(PDFDoc * doc);
   virtual bool render_page(PDFDoc * doc, int pageno);
   virtual void embed_image(int pageno);
+  virtual std::string dump_thumbnail(int pageno);
 
   // Does this device use beginType3Char/endType3Char?  Otherwise,
   // text in Type 3 fonts will be drawn with drawChar/drawString.
@@ -46,6 +55,23 @@ public:
       double originX, double originY,
       CharCode code, int nBytes, Unicode *u, int uLen);
 
+  virtual void drawImage(GfxState * state, Object * ref, Stream * str,
+      int width, int height, GfxImageColorMap * colorMap,
+      GBool interpolate, int *maskColors, GBool inlineImg);
+
+  // paths drawn with CSS are skipped, see HTMLRenderer::add_css_drawing()
+  virtual void stroke(GfxState *state);
+  virtual void fill(GfxState *state);
+  virtual void eoFill(GfxState *state);
+  virtual GBool axialShadedFill(GfxState *state, GfxAxialShading *shading, double tMin, double tMax);
+
+  // for --bg-shared-forms, forms are drawn by drawForm() while rendering pages with shared forms
+  virtual GBool useDrawForm() { return (cur_gfx != nullptr) ? gTrue : gFalse; }
+  virtual void drawForm(Ref id);
+  virtual void setSoftMask(GfxState *state, double *bbox, GBool alpha,
+      Function *transferFunc, GfxColor *backdropColor);
+  virtual void clearSoftMask(GfxState *state);
+
   //for proof
   void beginTextObject(GfxState *state);
   void beginString(GfxState *state, GooString * str);
@@ -53,11 +79,113 @@ public:
   void updateRender(GfxState *state);
 
 protected:
-  void dump_image(const char * filename, int x1, int y1, int x2, int y2);
+  // img_format: "png", "jpg", "webp" or "avif"
+  // for png, the image is written with palette if it is not empty, or in grayscale if gray_image is set
+  // bitmap: the page bitmap, or a downscaled copy of it
+  void dump_image(const char * filename, const std::string & img_format, SplashBitmap * bitmap,
+          int x1, int y1, int x2, int y2);
+  // for --bg-format png or auto
+  // choose the format for a region of the bitmap, and set palette, quantize_map and gray_image accordingly
+  std::string choose_format(SplashBitmap * bitmap, int x1, int y1, int x2, int y2);
+  // for --bg-quantize
+  // fill palette with the popular colors of the region, and quantize_map for the rest
+  void quantize(SplashBitmap * bitmap, int x1, int y1, int x2, int y2);
+  // for --bg-srcset
+  std::string dump_scaled_image(const std::string & basename, double density, double h_scale, double v_scale,
+          int x1, int y1, int x2, int y2);
+  // whether all pixels in the region are of the paper color
+  bool is_blank(int x1, int y1, int x2, int y2);
+  // whether all pixels in the region are of the color (0xRRGGBB)
+  bool is_solid(int x1, int y1, int x2, int y2, unsigned color);
+  // for --bg-solid-min-size
+  // find rectangles of a single color other than the paper color in the region, which are large enough
+  // rects: x1, y1, x2, y2 of each; colors: 0xRRGGBB of each
+  void find_solid_rects(int xmin, int ymin, int xmax, int ymax, std::vector<int> & rects, std::vector<unsigned> & colors);
+  // for --bg-tile-size
+  void get_tiles(int xmin, int ymin, int xmax, int ymax, std::vector<int> & regions);
+
+  /*
+   * An image or a path in a layer, which might be drawn in HTML instead
+   */
+  struct LayerItem
+  {
+      std::string key;
+      bool is_image;
+      bool drawn_in_html; // in the page where the layer is rendered
+  };
+
+  /*
+   * A form drawn on multiple pages, which is rendered into a separate image
+   */
+  struct Layer
+  {
+      Ref ref;
+      double matrix[6]; // the CTM when the form is drawn, in page space
+      bool rendered;
+      std::string filename; // empty if nothing is drawn
+      int xmin, ymin, xmax, ymax; // the modified region, in the bitmap of the page
+      std::vector<LayerItem> items;
+  };
+
+  // render the page by our own Gfx, such that shared forms are skipped in drawForm()
+  void display_page(PDFDoc * doc, int pageno);
+  // draw a form XObject, as Gfx::doForm() does
+  // extra_matrix: applied after the matrix of the form, or nullptr
+  void draw_form(Gfx * gfx, Object * str, const double * extra_matrix);
+  // whether the graphics state is the same as the initial state of a page, in which layers are rendered
+  bool is_initial_state(GfxState * state);
+  void render_layer(PDFDoc * doc, int pageno, Layer & layer);
+  // whether images and paths in the layer are drawn in HTML in the current page as in the page where it is rendered
+  bool is_layer_usable(const Layer & layer);
+  // for --extract-image and --css-draw
+  // key: identifies an image or a path, is_image: whether key is from get_image_key()
+  bool is_drawn_in_html(const std::string & key, bool is_image);
+  void dump_layer_image(const char * filename, int x1, int y1, int x2, int y2);
+
   HTMLRenderer * html_renderer;
   const Param & param;
   std::string format;
   int drawn_char_count;
+  // for --bg-srcset, in descending order
+  std::vector<double> srcset_densities;
+  // colors of the image being dumped (0xRRGGBB), or empty if it is not written as a palette image
+  std::vector<unsigned> palette;
+  // for quantized images: 5-5-5 bit RGB -> index in palette
+  std::vector<unsigned char> quantize_map;
+  // whether the image being dumped is written in grayscale
+  bool gray_image;
+
+  // for --bg-gray-render, pages drawn only in gray are rendered by gray_renderer
+  bool is_gray_renderer;
+  bool use_gray_renderer;
+  std::unique_ptr<SplashBackgroundRenderer> gray_renderer;
+
+  // the region to be dumped as the background image: xmin, ymin, xmax, ymax
+  int bg_region[4];
+
+  // whether this device renders layers, instead of pages
+  bool is_layer_renderer;
+  std::unique_ptr<SplashBackgroundRenderer> layer_renderer;
+  // items of the layer being rendered by this device
+  std::vector<LayerItem> layer_items;
+  // map<key from Preprocessor::get_form_key(), layer>
+  std::unordered_map<std::string, Layer> layers;
+
+  struct PageLayer
+  {
+      Layer * layer;
+      // the region drawn between this layer and the previous one
+      int xmin, ymin, xmax, ymax;
+  };
+  // layers skipped in the current page, in drawing order
+  std::vector<PageLayer> page_layers;
+
+  Gfx * cur_gfx;
+  Page * cur_page;
+  XRef * cur_xref;
+  int form_depth;
+  bool soft_mask_active;
+  int layer_file_count;
 };
 
 } // namespace pdf2htmlEX
@@ -363,7 +363,7 @@ void DrawingTracer::draw_char(GfxState *state, double x, double y, double ax, do
     double char_cx, char_cy;
     itm.transform(cx, cy, &char_cx, &char_cy);
 
-    //TODO Vertical? Currently vertical/type3 chars are treated as non-chars.
+    //TODO Type 3? Currently type3 chars are treated as non-chars.
     double char_m[6] {fs * h, 0, 0, fs, char_cx + x, char_cy + y + ry};
 
     double final_m[6];
@@ -378,7 +378,10 @@ void DrawingTracer::draw_char(GfxState *state, double x, double y, double ax, do
         bbox[3] += asc;
     }
     else
-    {//TODO Vertical?
+    {
+        // the origin is the vertical origin, usually the top center of the glyph
+        bbox[0] -= 0.5;
+        bbox[2] += 0.5;
     }
     tm_transform_bbox(final_m, bbox);
     draw_char_bbox(state, bbox);
@@ -8,9 +8,13 @@
 #define HTMLRENDERER_H_
 
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <string>
 #include <cstdint>
 #include <fstream>
 #include <memory>
+#include <utility>
 
 #include <OutputDev.h>
 #include <GfxState.h>
@@ -34,6 +38,7 @@
 #include "Color.h"
 #include "StateManager.h"
 #include "HTMLTextPage.h"
+#include "SearchIndex.h"
 
 #include "BackgroundRenderer/BackgroundRenderer.h"
 #include "CoveredTextDetector.h"
@@ -130,6 +135,18 @@ struct HTMLRenderer : OutputDev
 
     virtual void drawImage(GfxState * state, Object * ref, Stream * str, int width, int height, GfxImageColorMap * colorMap, GBool interpolate, int *maskColors, GBool inlineImg);
 
+    virtual void drawImageMask(GfxState *state, Object *ref, Stream *str,
+                       int width, int height, GBool invert,
+                       GBool interpolate, GBool inlineImg);
+
+    virtual void drawMaskedImage(GfxState *state, Object *ref, Stream *str,
+                       int width, int height,
+                       GfxImageColorMap *colorMap,
+                       GBool interpolate,
+                       Stream *maskStr,
+                       int maskWidth, int maskHeight,
+                       GBool maskInvert, GBool maskInterpolate);
+
     virtual void drawSoftMaskedImage(GfxState *state, Object *ref, Stream *str,
                        int width, int height,
                        GfxImageColorMap *colorMap,
@@ -139,6 +156,16 @@ struct HTMLRenderer : OutputDev
                        GfxImageColorMap *maskColorMap,
                        GBool maskInterpolate);
 
+    virtual void setSoftMask(GfxState *state, double *bbox, GBool alpha,
+                       Function *transferFunc, GfxColor *backdropColor);
+    virtual void clearSoftMask(GfxState *state);
+
+    virtual void beginTransparencyGroup(GfxState *state, double *bbox,
+                       GfxColorSpace *blendingColorSpace,
+                       GBool isolated, GBool knockout,
+                       GBool forSoftMask);
+    virtual void endTransparencyGroup(GfxState *state);
+
     virtual void stroke(GfxState *state); 
     virtual void fill(GfxState *state);
     virtual void eoFill(GfxState *state);
@@ -155,6 +182,26 @@ struct HTMLRenderer : OutputDev
     // Currently drawn char (glyph) count in current page.
     int get_char_count() { return (int)covered_text_detector.get_chars_covered().size(); }
 
+    /*
+     * Extracted images, see image.cc
+     */
+    // Is an image extracted as a separate element, such that it should not be rendered in the background.
+    // key: see get_image_key() in util/image.h
+    bool is_image_extracted(const std::string & key);
+    // Called before annotations are drawn on a page.
+    void start_drawing_annotations() { drawing_annotations = true; }
+
+    /*
+     * CSS drawings, see draw.cc
+     */
+    // Is a path drawn as CSS elements, such that it should not be rendered in the background.
+    // op, default_ictm: see get_path_key() in util/image.h
+    bool is_css_drawn(GfxState * state, char op, const double * default_ictm);
+    // the same for axial shadings, see get_shading_key()
+    bool is_css_drawn(GfxState * state, GfxAxialShading * shading, const double * default_ictm);
+    // key: from get_path_key() or get_shading_key()
+    bool is_css_drawn(const std::string & key);
+
 protected:
     ////////////////////////////////////////////////////
     // misc
@@ -164,6 +211,7 @@ protected:
 
     void process_outline(void);
     void process_outline_items(GooList * items);
+    void process_outline_json(GooList * items);
 
     void process_form(std::ofstream & out);
     
@@ -173,6 +221,10 @@ protected:
 
     // convert a LinkAction to a string that our Javascript code can understand
     std::string get_linkaction_str(LinkAction *, std::string & detail);
+    // the page number of a LinkDest, 0 if not found
+    int get_linkdest_pageno(LinkDest * dest);
+    // look up a named destination, nullptr if not found
+    LinkDest * find_named_dest(GooString * name);
 
     ////////////////////////////////////////////////////
     /*
@@ -191,13 +243,93 @@ protected:
     std::string dump_embedded_font(GfxFont * font, FontInfo & info);
     std::string dump_type3_font(GfxFont * font, FontInfo & info);
     void embed_font(const std::string & filepath, GfxFont * font, FontInfo & info, bool get_metric_only = false);
+    int * get_code_to_gid(GfxFont * font, const std::string & filepath, const FontInfo & info, int & code2GID_len);
+    bool check_tounicode(GfxFont * font, const FontInfo & info, const int * code2GID, int code2GID_len, bool skip_unnamed);
     const FontInfo * install_font(GfxFont * font);
+    void install_text_json_font(GfxFont * font, FontInfo & info);
     void install_embedded_font(GfxFont * font, FontInfo & info);
     void install_external_font (GfxFont * font, FontInfo & info);
     void export_remote_font(const FontInfo & info, const std::string & suffix, GfxFont * font);
     void export_remote_default_font(long long fn_id);
     void export_local_font(const FontInfo & info, GfxFont * font, const std::string & original_font_name, const std::string & cssfont);
 
+    ////////////////////////////////////////////////////
+    // images
+    ////////////////////////////////////////////////////
+    // output an <img> for an image file, which is in tmp_dir if param.embed_image is on, or dest_dir otherwise
+    // filename: without directory, the suffix is used as the format
+    // left, bottom, width, height: in HTML units
+    // images with the same content as an earlier one are shared, see find_duplicate_image()
+    // srcset: files of the image in different resolutions and their pixel densities, including filename itself,
+    //   output as the srcset attribute if not empty; not used if param.embed_image is on
+    void dump_image_element(std::ostream & out, const std::string & css_class, const std::string & filename,
+            double left, double bottom, double width, double height,
+            const std::vector<std::pair<std::string, double>> & srcset = std::vector<std::pair<std::string, double>>());
+
+    // output a <div> painted with a CSS background, e.g. a color, for --css-draw and --bg-solid-min-size
+    // left, bottom, width, height: in HTML units
+    void dump_shape_element(std::ostream & out, double left, double bottom, double width, double height,
+            const std::string & background);
+
+    // MIME type of an image file, according to its suffix
+    std::string get_image_mime_type(const std::string & filename);
+
+    struct ImageFile;
+    // for --dedup-image
+    // return the image file output earlier with the same content, or nullptr if there isn't one
+    // the duplicated file will be removed if it is not the same file
+    ImageFile * find_duplicate_image(const std::string & filename);
+    // the image file registered by find_duplicate_image() as filename itself, or nullptr
+    ImageFile * find_image_file(const std::string & filename);
+
+    // whether an image is drawn upright and opaquely, without being clipped in the page
+    // if so, store its bbox (in HTML units) in bbox
+    bool get_image_placement(GfxState * state, double * bbox);
+
+    // for --bg-passthrough
+    void reset_page_image();
+    void check_page_image(GfxState * state, Object * ref, Stream * str, int width, int height,
+            GfxImageColorMap * colorMap, int * maskColors, GBool inlineImg);
+    // output the page image as the background, return false if it cannot be used
+    bool embed_page_image();
+
+    // for --extract-image
+    void check_extracted_image(GfxState * state, Object * ref, Stream * str, int width, int height,
+            GfxImageColorMap * colorMap, int * maskColors, GBool inlineImg);
+    // decide which images are to be extracted, must be called before the background is rendered
+    void finish_extracted_images();
+    void dump_extracted_images(std::ostream & out);
+
+    // for --css-draw
+    // whether something painted with the opacity in the current state can be drawn with CSS
+    bool is_css_drawable(GfxState * state, double opacity);
+    // return true if the path is drawn with CSS instead of in the background
+    bool add_css_drawing(GfxState * state, char op, const double * bbox);
+    // return true if the shading is drawn as a CSS gradient instead of in the background
+    bool add_css_gradient(GfxState * state, GfxAxialShading * shading);
+    // clear clip_is_rect unless the current path, which is used as the clip path, is a rectangle
+    void update_clip_rect(GfxState * state);
+    // decide which paths are drawn with CSS, must be called before finish_extracted_images()
+    void finish_css_drawings();
+    void dump_css_drawings(std::ostream & out);
+
+    // something other than the page image has to be rendered into the background
+    // bbox: in HTML units, or nullptr for the whole clip area
+    void background_drawn(GfxState * state, const double * bbox = nullptr);
+    void add_background_bbox(GfxState * state, const double * bbox);
+
+    // for --bg-gray-render
+    // clear page_gray unless the color space (or the color, if given) is gray
+    void check_gray(GfxColorSpace * cs, GfxColor * color = nullptr);
+
+    // for --thumbnail-width
+    // record the approximate box of a string drawn in HTML, dx and dy are its advance in text space
+    void add_thumbnail_text(GfxState * state, double dx, double dy);
+    void dump_thumbnail_index();
+
+    // for --search-index
+    void dump_search_index();
+
     // depending on --embed***, to embed the content or add a link to it
     // "type": specify the file type, usually it's the suffix, in which case this parameter could be ""
     // "copy": indicates whether to copy the file into dest_dir, if not embedded
@@ -215,7 +347,9 @@ protected:
     void check_state_change(GfxState * state);
     // prepare the line context, (close old tags, open new tags)
     // make sure the current HTML style consistent with PDF
-    void prepare_text_line(GfxState * state);
+    // origin_y: the vertical origin of the first char, in text space, for vertical fonts
+    // dx, dy: the position of the first char relative to the current point, in text space
+    void prepare_text_line(GfxState * state, double origin_y, double dx = 0, double dy = 0);
 
     ////////////////////////////////////////////////////
     // PDF stuffs
@@ -226,6 +360,15 @@ protected:
     Catalog * cur_catalog;
     int pageNum;
 
+    /*
+     * Catalog::findPage() and Catalog::findDest() may walk the whole page tree or name tree,
+     * which is too slow for documents with many links or outline items
+     * page numbers are indexed by hash_ref() of the page refs in pre_process()
+     * named destinations are cached when first used, nullptr for missing ones
+     */
+    std::unordered_map<long long, int> page_numbers_by_ref;
+    std::unordered_map<std::string, std::unique_ptr<LinkDest>> named_dests;
+
     double default_ctm[6];
 
     /*
@@ -288,6 +431,11 @@ protected:
     // also keep in mind that they are not the final position, as they will be transform by CTM (also true for cur_tx/ty)
     double draw_tx, draw_ty; 
 
+    // the vertical origin of the chars in the current vertical line, see prepare_text_line()
+    double line_origin_y;
+    // whether a warning about unsupported horizontal origins of vertical chars has been shown
+    bool vertical_origin_warned;
+
 
     ////////////////////////////////////////////////////
     // styles & resources
@@ -301,6 +449,99 @@ protected:
 
     HTMLTextPage html_text_page;
 
+    /*
+     * The only graphic of the current page, if it is an image that can be used as the background directly
+     * Typically the scanned image of a page
+     */
+    struct PageImage
+    {
+        enum Type { NONE, JPEG, BILEVEL } type;
+        bool usable; // nothing else is found in the background so far
+        Ref ref;
+        int width, height;
+        bool invert; // BILEVEL only: whether 0 samples are white
+        double bbox[4]; // x0, y0, x1, y1 in HTML units
+    } page_image;
+
+    /*
+     * Images drawn by drawImage() in the current page, in drawing order
+     * An image is extracted as a separate <img>, if nothing in the background is drawn over it
+     */
+    struct PageImageElement
+    {
+        std::string filename; // empty if the image is rendered in the background
+        std::string key; // see get_image_key()
+        long long id; // key in extracted_image_files
+        double bbox[4]; // x0, y0, x1, y1 in HTML units
+        size_t drawing_index; // number of background drawings before this image
+    };
+    std::vector<PageImageElement> page_image_elements;
+    std::unordered_set<std::string> extracted_image_keys;
+
+    /*
+     * Paths filled or stroked in the current page, which can be drawn as CSS <div>s, in drawing order
+     * A path is drawn with CSS if nothing in the background is drawn over it
+     */
+    struct CSSDrawing
+    {
+        std::string key; // see get_path_key()
+        std::vector<double> rects; // x0, y0, x1, y1, ... in HTML units
+        std::string background; // the CSS background, a color or a gradient
+        double bbox[4]; // x0, y0, x1, y1 in HTML units
+        size_t drawing_index; // number of background drawings before this path
+        bool visible; // false if it is rendered in the background
+    };
+    std::vector<CSSDrawing> css_drawings;
+    std::unordered_set<std::string> css_drawn_keys;
+    // the clip area is a rectangle, i.e. its bbox
+    bool clip_is_rect;
+    std::vector<bool> clip_is_rect_stack;
+    // annotations are being drawn, which might be hidden in the background
+    bool drawing_annotations;
+    // bboxes of background drawings in the current page: x0, y0, x1, y1, ...
+    std::vector<double> background_bboxes;
+    int transparency_group_depth;
+    bool soft_mask_active;
+    // everything drawn in the current page is gray, such that the background can be rendered in grayscale
+    bool page_gray;
+
+    struct ThumbnailText
+    {
+        double bbox[4]; // x0, y0, x1, y1 in HTML units
+        unsigned color; // 0xRRGGBB
+    };
+    // texts in HTML of the current page, which are not in the background
+    std::vector<ThumbnailText> thumbnail_texts;
+    // page number, filename
+    std::vector<std::pair<int, std::string>> thumbnail_files;
+
+    // words in HTML of all pages
+    SearchIndex search_index;
+
+    struct ExtractedImageFile
+    {
+        std::string filename;
+        bool used;
+    };
+    // map<hash_ref of the image stream, file>
+    std::unordered_map<long long, ExtractedImageFile> extracted_image_files;
+
+    /*
+     * Image files referred in the output, identified by their content
+     * If embedded, an image is put into a CSS class, shared by all its occurrences, since it is not known
+     * at its first occurrence whether it will be used again
+     */
+    struct ImageFile
+    {
+        std::string filename;
+        long long css_id; // id of the CSS class with the data of the image, or -1
+    };
+    // map<digest of the content, the first file>
+    std::unordered_map<std::string, ImageFile> image_files;
+    // map<filename, digest of the content>
+    std::unordered_map<std::string, std::string> image_file_digests;
+    long long image_data_count;
+
     enum NewLineState
     {
         NLS_NONE,
@@ -313,6 +554,7 @@ protected:
     std::vector<int32_t> cur_mapping; 
     std::vector<char*> cur_mapping2;
     std::vector<int> width_list; // width of each char
+    std::vector<int> vertical_width_list; // vertical advance of each char, for vertical fonts
 
     Preprocessor preprocessor;
 
@@ -336,6 +578,11 @@ protected:
     } f_outline, f_pages, f_css;
     std::ofstream * f_curpage;
     std::string cur_page_filename;
+    // the byte offset of the current page in its file, for --page-bundle-size
+    long long cur_page_offset;
+    // for --text-json, points to f_text_json_file or std::cout
+    std::ofstream f_text_json_file;
+    std::ostream * f_text_json;
 
     static const std::string MANIFEST_FILENAME;
 
@@ -9,6 +9,7 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <sstream>
 #include <vector>
 #include <iostream>
@@ -16,6 +17,7 @@
 #include "HTMLRenderer.h"
 #include "util/misc.h"
 #include "util/math.h"
+#include "util/image.h"
 #include "util/namespace.h"
 
 namespace pdf2htmlEX {
@@ -29,37 +31,534 @@ using std::ostringstream;
 using std::sqrt;
 using std::vector;
 using std::ostream;
+using std::string;
 
 void HTMLRenderer::restoreState(GfxState * state)
 {
     updateAll(state);
     tracer.restore();
+    if(!clip_is_rect_stack.empty())
+    {
+        clip_is_rect = clip_is_rect_stack.back();
+        clip_is_rect_stack.pop_back();
+    }
 }
 
 void HTMLRenderer::saveState(GfxState *state)
 {
     tracer.save();
+    clip_is_rect_stack.push_back(clip_is_rect);
+}
+
+/*
+ * bbox of the current path in device space, including control points of curves
+ * pad: extra width added to all sides
+ */
+static bool get_path_bbox(GfxState * state, double * bbox, double pad)
+{
+    GfxPath * path = state->getPath();
+    bool empty = true;
+    for(int i = 0; i < path->getNumSubpaths(); ++i)
+    {
+        GfxSubpath * subpath = path->getSubpath(i);
+        for(int j = 0; j < subpath->getNumPoints(); ++j)
+        {
+            double x, y;
+            state->transform(subpath->getX(j), subpath->getY(j), &x, &y);
+            if(empty)
+            {
+                bbox[0] = bbox[2] = x;
+                bbox[1] = bbox[3] = y;
+                empty = false;
+            }
+            else
+            {
+                bbox[0] = min(bbox[0], x);
+                bbox[1] = min(bbox[1], y);
+                bbox[2] = max(bbox[2], x);
+                bbox[3] = max(bbox[3], y);
+            }
+        }
+    }
+    if(empty)
+        return false;
+
+    bbox[0] -= pad;
+    bbox[1] -= pad;
+    bbox[2] += pad;
+    bbox[3] += pad;
+    return true;
+}
+
+/*
+ * For --css-draw
+ * Get the rectangles (x0, y0, x1, y1, ... in device space) painted by the current path, if it consists of
+ * - for fill: axis-aligned rectangles not overlapping each other
+ * - for stroke: horizontal/vertical lines or axis-aligned rectangles, with butt or projecting caps and miter joins
+ * Return false otherwise
+ */
+static bool get_css_rects(GfxState * state, bool stroke, vector<double> & rects)
+{
+    // errors allowed in device space
+    const double tolerance = 0.01;
+    auto near = [tolerance](double a, double b) { return std::abs(a - b) < tolerance; };
+
+    double half_width = 0;
+    if(stroke)
+    {
+        // the line width is not uniform unless the CTM keeps the aspect ratio
+        const double * ctm = state->getCTM();
+        if(!((equal(ctm[1], 0) && equal(ctm[2], 0) && equal(std::abs(ctm[0]), std::abs(ctm[3])))
+             || (equal(ctm[0], 0) && equal(ctm[3], 0) && equal(std::abs(ctm[1]), std::abs(ctm[2])))))
+            return false;
+
+        double * dash;
+        int dash_length;
+        double dash_start;
+        state->getLineDash(&dash, &dash_length, &dash_start);
+        if((dash_length > 0) || (state->getLineCap() == 1))
+            return false;
+
+        // hairlines are one device pixel wide, which cannot be told here
+        half_width = state->transformWidth(state->getLineWidth()) / 2;
+        if(half_width < tolerance)
+            return false;
+    }
+
+    rects.clear();
+    GfxPath * path = state->getPath();
+    for(int i = 0; i < path->getNumSubpaths(); ++i)
+    {
+        GfxSubpath * subpath = path->getSubpath(i);
+        vector<double> points;
+        for(int j = 0; j < subpath->getNumPoints(); ++j)
+        {
+            if(subpath->getCurve(j))
+                return false;
+            double x, y;
+            state->transform(subpath->getX(j), subpath->getY(j), &x, &y);
+            points.push_back(x);
+            points.push_back(y);
+        }
+
+        // the last point of a closed subpath is usually the same as the first one
+        if((points.size() > 4) && near(points[0], points[points.size() - 2]) && near(points[1], points.back()))
+            points.resize(points.size() - 2);
+
+        // every edge must be horizontal or vertical
+        size_t n = points.size() / 2;
+        for(size_t j = 0; j + 1 < n; ++j)
+        {
+            if(!near(points[j * 2], points[j * 2 + 2]) && !near(points[j * 2 + 1], points[j * 2 + 3]))
+                return false;
+        }
+
+        double bbox[4] = { points[0], points[1], points[0], points[1] };
+        for(size_t j = 1; j < n; ++j)
+        {
+            bbox[0] = min(bbox[0], points[j * 2]);
+            bbox[1] = min(bbox[1], points[j * 2 + 1]);
+            bbox[2] = max(bbox[2], points[j * 2]);
+            bbox[3] = max(bbox[3], points[j * 2 + 1]);
+        }
+
+        if((n == 2) && stroke && !subpath->isClosed())
+        {
+            // a straight line, extended by the projecting cap
+            double extension = (state->getLineCap() == 2) ? half_width : 0;
+            if(near(bbox[1], bbox[3]) && !near(bbox[0], bbox[2]))
+            {
+                double r[4] = { bbox[0] - extension, bbox[1] - half_width, bbox[2] + extension, bbox[1] + half_width };
+                rects.insert(rects.end(), r, r + 4);
+            }
+            else if(near(bbox[0], bbox[2]) && !near(bbox[1], bbox[3]))
+            {
+                double r[4] = { bbox[0] - half_width, bbox[1] - extension, bbox[0] + half_width, bbox[3] + extension };
+                rects.insert(rects.end(), r, r + 4);
+            }
+            else
+            {
+                return false;
+            }
+            continue;
+        }
+
+        // a rectangle has 4 corners, and its edges alternate between horizontal and vertical
+        if((n != 4) || near(bbox[0], bbox[2]) || near(bbox[1], bbox[3]))
+            return false;
+        for(size_t j = 0; j < n; ++j)
+        {
+            if(!(near(points[j * 2], bbox[0]) || near(points[j * 2], bbox[2]))
+               || !(near(points[j * 2 + 1], bbox[1]) || near(points[j * 2 + 1], bbox[3])))
+                return false;
+        }
+        if(near(points[0], points[2]) == near(points[2], points[4]))
+            return false;
+
+        if(!stroke)
+        {
+            // overlapping areas might be cancelled out, depending on the winding
+            for(size_t j = 0; j < rects.size(); j += 4)
+            {
+                if(bbox_intersect(bbox, &rects[j]))
+                    return false;
+            }
+            rects.insert(rects.end(), bbox, bbox + 4);
+            continue;
+        }
+
+        // an open subpath has caps instead of joins at its ends, and might miss an edge
+        if(!subpath->isClosed() || (state->getLineJoin() != 0))
+            return false;
+        double outer[4] = { bbox[0] - half_width, bbox[1] - half_width, bbox[2] + half_width, bbox[3] + half_width };
+        double inner[4] = { bbox[0] + half_width, bbox[1] + half_width, bbox[2] - half_width, bbox[3] - half_width };
+        if((inner[0] >= inner[2]) || (inner[1] >= inner[3]))
+        {
+            rects.insert(rects.end(), outer, outer + 4);
+        }
+        else
+        {
+            double r[16] = {
+                outer[0], outer[1], outer[2], inner[1], // bottom
+                outer[0], inner[3], outer[2], outer[3], // top
+                outer[0], inner[1], inner[0], inner[3], // left
+                inner[2], inner[1], outer[2], inner[3], // right
+            };
+            rects.insert(rects.end(), r, r + 16);
+        }
+    }
+
+    return !rects.empty();
+}
+
+void HTMLRenderer::update_clip_rect(GfxState * state)
+{
+    vector<double> rects;
+    if(!(get_css_rects(state, false, rects) && (rects.size() == 4)))
+        clip_is_rect = false;
 }
 
 void HTMLRenderer::stroke(GfxState * state)
 {
     tracer.stroke(state);
+    check_gray(state->getStrokeColorSpace(), state->getStrokeColor());
+
+    double bbox[4];
+    // the line width is used instead of half of it, to cover miter joins roughly
+    if(get_path_bbox(state, bbox, state->transformWidth(state->getLineWidth()) + 1)
+       && !add_css_drawing(state, 's', bbox))
+        background_drawn(state, bbox);
 }
 
 void HTMLRenderer::fill(GfxState * state)
 {
     tracer.fill(state);
+    check_gray(state->getFillColorSpace(), state->getFillColor());
+
+    double bbox[4];
+    if(get_path_bbox(state, bbox, 1) && !add_css_drawing(state, 'f', bbox))
+        background_drawn(state, bbox);
 }
 
 void HTMLRenderer::eoFill(GfxState * state)
 {
     tracer.fill(state, true);
+    check_gray(state->getFillColorSpace(), state->getFillColor());
+
+    double bbox[4];
+    if(get_path_bbox(state, bbox, 1) && !add_css_drawing(state, 'e', bbox))
+        background_drawn(state, bbox);
 }
 
 GBool HTMLRenderer::axialShadedFill(GfxState *state, GfxAxialShading *shading, double tMin, double tMax)
 {
     tracer.fill(state); //TODO correct?
+    check_gray(shading->getColorSpace());
+    if(!add_css_gradient(state, shading))
+        background_drawn(state);
+    return true;
+}
+
+bool HTMLRenderer::is_css_drawn(GfxState * state, char op, const double * default_ictm)
+{
+    return (!css_drawn_keys.empty()) && (css_drawn_keys.count(get_path_key(state, op, default_ictm)) > 0);
+}
+
+bool HTMLRenderer::is_css_drawn(GfxState * state, GfxAxialShading * shading, const double * default_ictm)
+{
+    return (!css_drawn_keys.empty()) && (css_drawn_keys.count(get_shading_key(state, shading, default_ictm)) > 0);
+}
+
+bool HTMLRenderer::is_css_drawn(const string & key)
+{
+    return css_drawn_keys.count(key) > 0;
+}
+
+// whether something painted with the opacity in the current state can be drawn with CSS
+bool HTMLRenderer::is_css_drawable(GfxState * state, double opacity)
+{
+    return param.css_draw && !param.fallback && !param.proof
+        && (!drawing_annotations || param.process_annotation)
+        && equal(opacity, 1) && (state->getBlendMode() == gfxBlendNormal)
+        && !soft_mask_active && (transparency_group_depth == 0);
+}
+
+/*
+ * Called for every path filled or stroked
+ * Return true if the path can be drawn with CSS, see get_css_rects()
+ * bbox: the bbox of the path in HTML units
+ */
+bool HTMLRenderer::add_css_drawing(GfxState * state, char op, const double * bbox)
+{
+    bool stroke = (op == 's');
+    // the path is cut by the bbox of the clip path below
+    if(!is_css_drawable(state, stroke ? state->getStrokeOpacity() : state->getFillOpacity()) || !clip_is_rect)
+        return false;
+
+    GfxColorSpace * cs = stroke ? state->getStrokeColorSpace() : state->getFillColorSpace();
+    if(cs->getMode() == csPattern)
+        return false;
+
+    CSSDrawing drawing;
+    if(!get_css_rects(state, stroke, drawing.rects))
+        return false;
+
+    // the clip path is a rectangle, i.e. its bbox
+    double clip_bbox[4];
+    state->getClipBBox(&clip_bbox[0], &clip_bbox[1], &clip_bbox[2], &clip_bbox[3]);
+    vector<double> rects;
+    for(size_t i = 0; i < drawing.rects.size(); i += 4)
+    {
+        double r[4];
+        if(bbox_intersect(&drawing.rects[i], clip_bbox, r))
+            rects.insert(rects.end(), r, r + 4);
+    }
+    drawing.rects.swap(rects);
+
+    // it is still drawn over the page image
+    page_image.usable = false;
+
+    GfxRGB rgb;
+    if(stroke)
+        state->getStrokeRGB(&rgb);
+    else
+        state->getFillRGB(&rgb);
+    ostringstream sout;
+    sout << rgb;
+    drawing.background = sout.str();
+    drawing.key = get_path_key(state, op, getDefICTM());
+    memcpy(drawing.bbox, bbox, sizeof(drawing.bbox));
+    drawing.drawing_index = background_bboxes.size() / 4;
+    drawing.visible = true;
+    css_drawings.push_back(drawing);
     return true;
 }
 
+/*
+ * Called for every axial shading
+ * Return true if the shading can be drawn as a CSS linear-gradient, that is
+ * - the clip path is a rectangle, see update_clip_rect()
+ * - the shading is not clipped by its BBox, and it is extended wherever it is visible
+ * - its colors can be interpolated linearly between a few stops
+ */
+bool HTMLRenderer::add_css_gradient(GfxState * state, GfxAxialShading * shading)
+{
+    if(!is_css_drawable(state, state->getFillOpacity()) || !clip_is_rect || shading->getHasBBox())
+        return false;
+
+    CSSDrawing drawing;
+    double clip_bbox[4];
+    state->getClipBBox(&clip_bbox[0], &clip_bbox[1], &clip_bbox[2], &clip_bbox[3]);
+    double page_bbox[4] = { 0, 0, state->getPageWidth(), state->getPageHeight() };
+    if(!bbox_intersect(clip_bbox, page_bbox, drawing.bbox))
+        return false;
+    const double * rect = drawing.bbox;
+    double width = rect[2] - rect[0];
+    double height = rect[3] - rect[1];
+    if(!is_positive(width) || !is_positive(height))
+        return false;
+
+    // s(x, y) = a[0] * x + a[1] * y + a[2], the position on the axis of a point in device space:
+    // 0 at (x0, y0) and 1 at (x1, y1) of the shading
+    double coords[4];
+    shading->getCoords(&coords[0], &coords[1], &coords[2], &coords[3]);
+    double dx = coords[2] - coords[0];
+    double dy = coords[3] - coords[1];
+    double len2 = dx * dx + dy * dy;
+    const double * ctm = state->getCTM();
+    double det = ctm[0] * ctm[3] - ctm[1] * ctm[2];
+    if(!is_positive(len2) || equal(det, 0))
+        return false;
+    double ictm[6] = {
+        ctm[3] / det, -ctm[1] / det, -ctm[2] / det, ctm[0] / det,
+        (ctm[2] * ctm[5] - ctm[3] * ctm[4]) / det, (ctm[1] * ctm[4] - ctm[0] * ctm[5]) / det
+    };
+    double a[3] = {
+        (ictm[0] * dx + ictm[1] * dy) / len2,
+        (ictm[2] * dx + ictm[3] * dy) / len2,
+        ((ictm[4] - coords[0]) * dx + (ictm[5] - coords[1]) * dy) / len2
+    };
+    auto s_at = [&a](double x, double y) { return a[0] * x + a[1] * y + a[2]; };
+    double a_len = std::hypot(a[0], a[1]);
+    if(!is_positive(a_len))
+        return false;
+
+    // the visible part of the axis, which is not painted if not extended
+    double s_min = s_at(rect[0], rect[1]);
+    double s_max = s_min;
+    for(double x : { rect[0], rect[2] })
+    {
+        for(double y : { rect[1], rect[3] })
+        {
+            s_min = min(s_min, s_at(x, y));
+            s_max = max(s_max, s_at(x, y));
+        }
+    }
+    const double s_tolerance = 0.001;
+    if((!shading->getExtend0() && (s_min < -s_tolerance)) || (!shading->getExtend1() && (s_max > 1 + s_tolerance)))
+        return false;
+
+    // sample the colors along the axis, and find the stops between which the colors are linear
+    const int sample_count = 256;
+    const double color_tolerance = 1.5 / 255;
+    const size_t max_stop_count = 32;
+    double t0 = shading->getDomain0();
+    double t1 = shading->getDomain1();
+    vector<GfxRGB> samples(sample_count + 1);
+    for(int i = 0; i <= sample_count; ++i)
+    {
+        GfxColor color;
+        shading->getColor(t0 + (t1 - t0) * i / sample_count, &color);
+        shading->getColorSpace()->getRGB(&color, &samples[i]);
+    }
+    auto is_linear = [&samples, color_tolerance](int i, int j) {
+        for(int k = i + 1; k < j; ++k)
+        {
+            double f = double(k - i) / (j - i);
+            if((std::abs(colToDbl(samples[k].r) - (colToDbl(samples[i].r) * (1 - f) + colToDbl(samples[j].r) * f)) > color_tolerance)
+               || (std::abs(colToDbl(samples[k].g) - (colToDbl(samples[i].g) * (1 - f) + colToDbl(samples[j].g) * f)) > color_tolerance)
+               || (std::abs(colToDbl(samples[k].b) - (colToDbl(samples[i].b) * (1 - f) + colToDbl(samples[j].b) * f)) > color_tolerance))
+                return false;
+        }
+        return true;
+    };
+    vector<int> stops(1, 0);
+    for(int j = 2; j <= sample_count; ++j)
+    {
+        if(!is_linear(stops.back(), j))
+        {
+            stops.push_back(j - 1);
+            if(stops.size() >= max_stop_count)
+                return false;
+        }
+    }
+    stops.push_back(sample_count);
+
+    // the gradient line of CSS passes through the center of the box, with the corners at both ends
+    // the angle is clockwise from the top, and y goes up in device space
+    double gx = a[0] / a_len;
+    double gy = a[1] / a_len;
+    double line_length = std::abs(width * gx) + std::abs(height * gy);
+    double s_start = s_at((rect[0] + rect[2]) / 2, (rect[1] + rect[3]) / 2) - a_len * line_length / 2;
+
+    ostringstream sout;
+    const double pi = std::acos(-1.0);
+    sout << "linear-gradient(" << round(std::atan2(gx, gy) * 180 / pi) << "deg";
+    for(int i : stops)
+    {
+        double s = double(i) / sample_count;
+        sout << "," << samples[i] << " " << round((s - s_start) / (a_len * line_length) * 100) << "%";
+    }
+    sout << ")";
+
+    page_image.usable = false;
+    drawing.background = sout.str();
+    drawing.rects.assign(rect, rect + 4);
+    drawing.key = get_shading_key(state, shading, getDefICTM());
+    drawing.drawing_index = background_bboxes.size() / 4;
+    drawing.visible = true;
+    css_drawings.push_back(drawing);
+    return true;
+}
+
+/*
+ * A CSS drawing is placed above the background, so it cannot be used if
+ * anything in the background is drawn over it, including other CSS drawings
+ * that cannot be used. Overlapping extracted images are avoided as well, as
+ * their order is unknown.
+ */
+void HTMLRenderer::finish_css_drawings()
+{
+    css_drawn_keys.clear();
+    if(!param.css_draw)
+        return;
+
+    size_t background_count = background_bboxes.size() / 4;
+    // bboxes of CSS drawings rendered in the background, in reversed drawing order
+    vector<const double *> background_drawings;
+    for(auto iter = css_drawings.rbegin(); iter != css_drawings.rend(); ++iter)
+    {
+        auto & drawing = *iter;
+
+        bool covered = false;
+        for(size_t i = drawing.drawing_index; (!covered) && (i < background_count); ++i)
+            covered = bbox_intersect(drawing.bbox, &background_bboxes[i * 4]);
+        for(size_t i = 0; (!covered) && (i < background_drawings.size()); ++i)
+            covered = bbox_intersect(drawing.bbox, background_drawings[i]);
+        for(size_t i = 0; (!covered) && (i < page_image_elements.size()); ++i)
+            covered = (!page_image_elements[i].filename.empty())
+                && bbox_intersect(drawing.bbox, page_image_elements[i].bbox);
+
+        if(covered)
+        {
+            drawing.visible = false;
+            background_drawings.push_back(drawing.bbox);
+        }
+    }
+
+    for(auto & drawing : css_drawings)
+    {
+        if(drawing.visible)
+            css_drawn_keys.insert(drawing.key);
+    }
+    // the same path might be drawn at the same place more than once
+    for(auto & drawing : css_drawings)
+    {
+        if(!drawing.visible)
+            css_drawn_keys.erase(drawing.key);
+    }
+    for(auto & drawing : css_drawings)
+    {
+        if(drawing.visible && !css_drawn_keys.count(drawing.key))
+            drawing.visible = false;
+    }
+}
+
+void HTMLRenderer::dump_css_drawings(ostream & out)
+{
+    for(auto & drawing : css_drawings)
+    {
+        if(!drawing.visible)
+            continue;
+
+        for(size_t i = 0; i < drawing.rects.size(); i += 4)
+        {
+            const double * r = &drawing.rects[i];
+            dump_shape_element(out, r[0], r[1], r[2] - r[0], r[3] - r[1], drawing.background);
+        }
+    }
+}
+
+void HTMLRenderer::dump_shape_element(ostream & out, double left, double bottom, double width, double height,
+        const string & background)
+{
+    out << "<div class=\"" << CSS::SHAPE_CN
+        << " " << CSS::SHAPE_BACKGROUND_CN  << all_manager.shape_background.install(background)
+        << " " << CSS::LEFT_CN              << all_manager.left.install(left)
+        << " " << CSS::BOTTOM_CN            << all_manager.bottom.install(bottom)
+        << " " << CSS::WIDTH_CN             << all_manager.width.install(width)
+        << " " << CSS::HEIGHT_CN            << all_manager.height.install(height)
+        << "\"></div>";
+}
+
 } // namespace pdf2htmlEX
@@ -186,6 +186,34 @@ string HTMLRenderer::dump_embedded_font (GfxFont * font, FontInfo & info)
     return filepath;
 }
 
+#if ENABLE_SVG
+/*
+ * The glyph bbox of a Type 3 font, transformed by its font matrix
+ */
+static void get_type3_font_bbox(GfxFont * font, double * transformed_bbox)
+{
+    memcpy(transformed_bbox, font->getFontBBox(), 4 * sizeof(double));
+    /*
+    // add the origin to the bbox
+    if(transformed_bbox[0] > 0) transformed_bbox[0] = 0;
+    if(transformed_bbox[1] > 0) transformed_bbox[1] = 0;
+    if(transformed_bbox[2] < 0) transformed_bbox[2] = 0;
+    if(transformed_bbox[3] < 0) transformed_bbox[3] = 0;
+    */
+    tm_transform_bbox(font->getFontMatrix(), transformed_bbox);
+}
+
+/*
+ * Type 3 glyphs are dumped such that the longer edge of the bbox is 1 em
+ */
+static double get_type3_font_size_scale(GfxFont * font)
+{
+    double transformed_bbox[4];
+    get_type3_font_bbox(font, transformed_bbox);
+    return std::max(transformed_bbox[2] - transformed_bbox[0], transformed_bbox[3] - transformed_bbox[1]);
+}
+#endif
+
 string HTMLRenderer::dump_type3_font (GfxFont * font, FontInfo & info)
 {
     assert(info.is_type3);
@@ -203,18 +231,10 @@ string HTMLRenderer::dump_type3_font (GfxFont * font, FontInfo & info)
     double * font_bbox = font->getFontBBox();
     double * font_matrix = font->getFontMatrix();
     double transformed_bbox[4];
-    memcpy(transformed_bbox, font_bbox, 4 * sizeof(double));
-    /*
-    // add the origin to the bbox
-    if(transformed_bbox[0] > 0) transformed_bbox[0] = 0;
-    if(transformed_bbox[1] > 0) transformed_bbox[1] = 0;
-    if(transformed_bbox[2] < 0) transformed_bbox[2] = 0;
-    if(transformed_bbox[3] < 0) transformed_bbox[3] = 0;
-    */
-    tm_transform_bbox(font_matrix, transformed_bbox);
+    get_type3_font_bbox(font, transformed_bbox);
     double transformed_bbox_width = transformed_bbox[2] - transformed_bbox[0];
     double transformed_bbox_height = transformed_bbox[3] - transformed_bbox[1];
-    info.font_size_scale = std::max(transformed_bbox_width, transformed_bbox_height);
+    info.font_size_scale = get_type3_font_size_scale(font);
 
     // we want the glyphs is rendered in a box of size around GLYPH_DUMP_EM_SIZE x GLYPH_DUMP_EM_SIZE
     // for rectangles, the longer edge should be GLYPH_DUMP_EM_SIZE
@@ -373,6 +393,102 @@ string HTMLRenderer::dump_type3_font (GfxFont * font, FontInfo & info)
 #endif
 }
 
+/*
+ * The map from char codes (CIDs for CID fonts) to GIDs of a TrueType font file,
+ * nullptr if the codes are used as they are
+ */
+int * HTMLRenderer::get_code_to_gid(GfxFont * font, const string & filepath, const FontInfo & info, int & code2GID_len)
+{
+    code2GID_len = 0;
+
+    string suffix = get_suffix(filepath);
+    for(auto & c : suffix)
+        c = tolower(c);
+
+    // Type 3 fonts are converted into ttf fonts encoded based on code points, see embed_font()
+    if(!is_truetype_suffix(suffix) || info.is_type3)
+        return nullptr;
+
+    int * code2GID = nullptr;
+    if(!font->isCIDFont())
+    {
+        if(FoFiTrueType * fftt = FoFiTrueType::load((char*)filepath.c_str()))
+        {
+            code2GID = dynamic_cast<Gfx8BitFont*>(font)->getCodeToGIDMap(fftt);
+            code2GID_len = 256;
+            delete fftt;
+        }
+    }
+    else
+    {
+        GfxCIDFont * _font = dynamic_cast<GfxCIDFont*>(font);
+
+        // To locate CID2GID for the font
+        // as in CairoFontEngine.cc
+        if((code2GID = _font->getCIDToGID()))
+        {
+            // use the mapping stored in _font
+            code2GID_len = _font->getCIDToGIDLen();
+        }
+        else
+        {
+            // use the mapping stored in the file
+            if(FoFiTrueType * fftt = FoFiTrueType::load((char*)filepath.c_str()))
+            {
+                code2GID = _font->getCodeToGIDMap(fftt, &code2GID_len);
+                delete fftt;
+            }
+        }
+    }
+    return code2GID;
+}
+
+/*
+ * Whether the ToUnicode CMap of a font is used
+ * In auto mode (--tounicode 0), it is dropped if two used codes are mapped to the same Unicode
+ *
+ * code2GID, code2GID_len: see get_code_to_gid()
+ * skip_unnamed: whether codes without glyph names are ignored, for 8bit non-TrueType fonts
+ */
+bool HTMLRenderer::check_tounicode(GfxFont * font, const FontInfo & info, const int * code2GID, int code2GID_len, bool skip_unnamed)
+{
+    if(param.tounicode != 0)
+        return (param.tounicode > 0);
+
+    const char * used_map = preprocessor.get_code_map(hash_ref(font->getID()));
+    if(!used_map)
+        return true;
+
+    int maxcode = font->isCIDFont() ? 0xffff : 0xff;
+    if(code2GID)
+        maxcode = min<int>(maxcode, code2GID_len - 1);
+
+    auto ctu = font->getToUnicode();
+    unordered_set<int> codeset;
+    bool valid = true;
+    for(int cur_code = 0; cur_code <= maxcode; ++cur_code)
+    {
+        if(!used_map[cur_code])
+            continue;
+        if(skip_unnamed && (dynamic_cast<Gfx8BitFont*>(font)->getCharName(cur_code) == nullptr))
+            continue;
+        if(code2GID && (code2GID[cur_code] == 0))
+            continue;
+
+        Unicode u, *pu=&u;
+        int n = ctu ? (ctu->mapToUnicode(cur_code, &pu)) : 0;
+        if(!codeset.insert(check_unicode(pu, n, cur_code, font)).second)
+        {
+            cerr << "ToUnicode CMap is not valid and got dropped for font: " << hex << info.id << dec << endl;
+            valid = false;
+            break;
+        }
+    }
+    if(ctu)
+        ctu->decRefCnt();
+    return valid;
+}
+
 void HTMLRenderer::embed_font(const string & filepath, GfxFont * font, FontInfo & info, bool get_metric_only)
 {
     if(param.debug)
@@ -403,6 +519,7 @@ void HTMLRenderer::embed_font(const string & filepath, GfxFont * font, FontInfo
 
     /*
      * if parm->tounicode is 0, try the provided tounicode map first
+     * it is checked for collisions in step 2
      */
     info.use_tounicode = (param.tounicode >= 0);
     bool has_space = false;
@@ -473,12 +590,7 @@ void HTMLRenderer::embed_font(const string & filepath, GfxFont * font, FontInfo
             else
             {
                 ffw_reencode_glyph_order();
-                if(FoFiTrueType * fftt = FoFiTrueType::load((char*)filepath.c_str()))
-                {
-                    code2GID = font_8bit->getCodeToGIDMap(fftt);
-                    code2GID_len = 256;
-                    delete fftt;
-                }
+                code2GID = get_code_to_gid(font, filepath, info, code2GID_len);
             }
         }
         else
@@ -526,25 +638,7 @@ void HTMLRenderer::embed_font(const string & filepath, GfxFont * font, FontInfo
         if(is_truetype_suffix(suffix))
         {
             ffw_reencode_glyph_order();
-
-            GfxCIDFont * _font = dynamic_cast<GfxCIDFont*>(font);
-
-            // To locate CID2GID for the font
-            // as in CairoFontEngine.cc
-            if((code2GID = _font->getCIDToGID()))
-            {
-                // use the mapping stored in _font
-                code2GID_len = _font->getCIDToGIDLen();
-            }
-            else
-            {
-                // use the mapping stored in the file
-                if(FoFiTrueType * fftt = FoFiTrueType::load((char*)filepath.c_str()))
-                {
-                    code2GID = _font->getCodeToGIDMap(fftt, &code2GID_len);
-                    delete fftt;
-                }
-            }
+            code2GID = get_code_to_gid(font, filepath, info, code2GID_len);
         }
         else
         {
@@ -582,16 +676,18 @@ void HTMLRenderer::embed_font(const string & filepath, GfxFont * font, FontInfo
         auto ctu = font->getToUnicode();
         std::fill(cur_mapping.begin(), cur_mapping.end(), -1);
         std::fill(width_list.begin(), width_list.end(), -1);
+        std::fill(vertical_width_list.begin(), vertical_width_list.end(), -1);
 
         if(code2GID)
             maxcode = min<int>(maxcode, code2GID_len - 1);
 
         bool is_truetype = is_truetype_suffix(suffix);
+        info.use_tounicode = check_tounicode(font, info, code2GID, code2GID_len, !is_truetype && (font_8bit != nullptr));
+
         int max_key = maxcode;
         /*
          * Traverse all possible codes
          */
-        bool retried = false; // avoid infinite loop
         for(int cur_code = 0; cur_code <= maxcode; ++cur_code)
         {
             if(!used_map[cur_code])
@@ -634,26 +730,7 @@ void HTMLRenderer::embed_font(const string & filepath, GfxFont * font, FontInfo
             else
             {
                 // collision detected
-                if(param.tounicode == 0)
-                {
-                    // in auto mode, just drop the tounicode map
-                    if(!retried)
-                    {
-                        cerr << "ToUnicode CMap is not valid and got dropped for font: " << hex << info.id << dec << endl;
-                        retried = true;
-                        codeset.clear();
-                        info.use_tounicode = false;
-                        std::fill(cur_mapping.begin(), cur_mapping.end(), -1);
-                        std::fill(width_list.begin(), width_list.end(), -1);
-                        cur_code = -1;
-                        if(param.debug)
-                        {
-                            map_outf.close();
-                            map_outf.open(map_filename);
-                        }
-                        continue;
-                    }
-                }
+                // in auto mode, the tounicode map has been dropped by check_tounicode() in this case
                 if(!name_conflict_warned)
                 {
                     name_conflict_warned = true;
@@ -695,6 +772,20 @@ void HTMLRenderer::embed_font(const string & filepath, GfxFont * font, FontInfo
                 }
                 
                 width_list[mapped_code] = (int)floor(cur_width * info.em_size + 0.5);
+
+                if(info.is_vertical && font_cid)
+                {
+                    // the vertical advance (negative, downwards) is only available from getNextChar
+                    char buf[2];
+                    buf[0] = (cur_code >> 8) & 0xff;
+                    buf[1] = (cur_code & 0xff);
+                    CharCode code;
+                    Unicode * pu2;
+                    int ulen;
+                    double ax, ay, ox, oy;
+                    font_cid->getNextChar(buf, 2, &code, &pu2, &ulen, &ax, &ay, &ox, &oy);
+                    vertical_width_list[mapped_code] = (int)floor(-ay * info.em_size + 0.5);
+                }
             }
 
             if(param.debug)
@@ -704,6 +795,8 @@ void HTMLRenderer::embed_font(const string & filepath, GfxFont * font, FontInfo
         }
 
         ffw_set_widths(width_list.data(), max_key + 1, param.stretch_narrow_glyph, param.squeeze_wide_glyph);
+        if(info.is_vertical)
+            ffw_set_vertical_widths(vertical_width_list.data(), max_key + 1);
         
         ffw_reencode_raw(cur_mapping.data(), max_key + 1, 1);
 
@@ -840,8 +933,10 @@ const FontInfo * HTMLRenderer::install_font(GfxFont * font)
         new_font_info.ascent = 0;
         new_font_info.descent = 0;
         new_font_info.is_type3 = false;
+        new_font_info.is_vertical = false;
 
-        export_remote_default_font(new_fn_id);
+        if(param.text_json.empty())
+            export_remote_default_font(new_fn_id);
 
         return &(new_font_info);
     }
@@ -849,6 +944,8 @@ const FontInfo * HTMLRenderer::install_font(GfxFont * font)
     new_font_info.ascent = font->getAscent();
     new_font_info.descent = font->getDescent();
     new_font_info.is_type3 = (font->getType() == fontType3);
+    new_font_info.is_vertical = (font->getWMode() && param.process_vertical_text);
+    new_font_info.name = font->getName() ? font->getName()->getCString() : "";
 
     if(param.debug)
     {
@@ -858,6 +955,15 @@ const FontInfo * HTMLRenderer::install_font(GfxFont * font)
             << endl;
     }
 
+    // for --text-json, fonts are not embedded, only the metrics in PDF are used
+    if(!param.text_json.empty())
+    {
+        new_font_info.em_size = 0;
+        new_font_info.space_width = 0;
+        install_text_json_font(font, new_font_info);
+        return &new_font_info;
+    }
+
     if(new_font_info.is_type3)
     {
 #if ENABLE_SVG
@@ -875,8 +981,8 @@ const FontInfo * HTMLRenderer::install_font(GfxFont * font)
 #endif
         return &new_font_info;
     }
-    if(font->getWMode()) {
-        cerr << "Writing mode is unsupported and will be rendered as Image" << endl;
+    if(font->getWMode() && !param.process_vertical_text) {
+        cerr << "Writing mode is disabled and will be rendered as Image" << endl;
         export_remote_default_font(new_fn_id);
         return &new_font_info;
     }
@@ -914,6 +1020,61 @@ const FontInfo * HTMLRenderer::install_font(GfxFont * font)
     return &new_font_info;
 }
 
+/*
+ * For --text-json, choose the Unicode values and the font size scale as the other install_*_font() functions,
+ * such that the text is the same as in HTML, without processing the fonts with FontForge
+ */
+void HTMLRenderer::install_text_json_font(GfxFont * font, FontInfo & info)
+{
+    if(info.is_type3)
+    {
+#if ENABLE_SVG
+        if(param.process_type3)
+        {
+            info.font_size_scale = get_type3_font_size_scale(font);
+            info.use_tounicode = check_tounicode(font, info, nullptr, 0, false);
+        }
+#endif
+        return;
+    }
+    if(font->getWMode() && !param.process_vertical_text)
+        return;
+
+    string path;
+    if(auto * font_loc = font->locateFont(xref, nullptr))
+    {
+        switch(font_loc -> locType)
+        {
+            case gfxFontLocEmbedded:
+                path = dump_embedded_font(font, info);
+                break;
+            case gfxFontLocResident:
+            case gfxFontLocExternal:
+                if(param.embed_external_font)
+                    path = font_loc->path->getCString();
+                else
+                    info.use_tounicode = (param.tounicode >= 0);
+                break;
+            default:
+                break;
+        }
+        delete font_loc;
+    }
+
+    // otherwise the remote default font is used
+    if(path != "")
+    {
+        string suffix = get_suffix(path);
+        for(auto & c : suffix)
+            c = tolower(c);
+
+        int code2GID_len = 0;
+        int * code2GID = get_code_to_gid(font, path, info, code2GID_len);
+        bool skip_unnamed = !font->isCIDFont() && !is_truetype_suffix(suffix);
+        info.use_tounicode = check_tounicode(font, info, code2GID, code2GID_len, skip_unnamed);
+    }
+}
+
 void HTMLRenderer::install_embedded_font(GfxFont * font, FontInfo & info)
 {
     auto path = dump_embedded_font(font, info);
@@ -8,6 +8,7 @@
 
 #include <cstdio>
 #include <ostream>
+#include <iostream>
 #include <cmath>
 #include <algorithm>
 #include <vector>
@@ -55,11 +56,17 @@ HTMLRenderer::HTMLRenderer(const Param & param)
         globalParams->setErrQuiet(gTrue);
     }
 
-    ffw_init(param.debug);
+    // fonts are not processed for --text-json
+    if(param.text_json.empty())
+        ffw_init(param.debug);
 
     cur_mapping.resize(0x10000);
     cur_mapping2.resize(0x100);
     width_list.resize(0x10000);
+    vertical_width_list.resize(0x10000);
+
+    image_data_count = 0;
+    vertical_origin_warned = false;
 
     /*
      * For these states, usually the error will not be accumulated
@@ -68,6 +75,7 @@ HTMLRenderer::HTMLRenderer(const Param & param)
      */
     all_manager.vertical_align.set_eps(param.v_eps);
     all_manager.whitespace    .set_eps(param.h_eps);
+    all_manager.vertical_whitespace.set_eps(param.v_eps);
     all_manager.left          .set_eps(param.h_eps);
     /*
      * For other states, we need accurate values
@@ -90,7 +98,15 @@ HTMLRenderer::HTMLRenderer(const Param & param)
 
 HTMLRenderer::~HTMLRenderer()
 {
-    ffw_finalize();
+    if(param.text_json.empty())
+        ffw_finalize();
+}
+
+// all annotations are drawn, just record that the page content is done
+static GBool annot_cb(Annot *, void * pRenderer)
+{
+    ((HTMLRenderer*)pRenderer)->start_drawing_annotations();
+    return gTrue;
 }
 
 void HTMLRenderer::process(PDFDoc *doc)
@@ -126,8 +142,11 @@ void HTMLRenderer::process(PDFDoc *doc)
 
         cerr << "Working: " << (i-param.first_page) << "/" << page_count << '\r' << flush;
 
-        if(param.split_pages)
+        // with page_bundle_size, a file is opened for the first page of every bundle, and named after it
+        if(param.split_pages && ((param.page_bundle_size <= 0) || ((i - param.first_page) % param.page_bundle_size == 0)))
         {
+            delete f_curpage;
+
             // copy the string out, since we will reuse the buffer soon
             string filled_template_filename = (char*)str_fmt(param.page_filename.c_str(), i);
             auto page_fn = str_fmt("%s/%s", param.dest_dir.c_str(), filled_template_filename.c_str());
@@ -138,6 +157,8 @@ void HTMLRenderer::process(PDFDoc *doc)
 
             cur_page_filename = filled_template_filename;
         }
+        if(param.split_pages)
+            cur_page_offset = f_curpage->tellp();
 
         doc->displayPage(this, i,
                 text_zoom_factor() * DEFAULT_DPI, text_zoom_factor() * DEFAULT_DPI,
@@ -145,14 +166,20 @@ void HTMLRenderer::process(PDFDoc *doc)
                 (!(param.use_cropbox)),
                 true,  // crop
                 false, // printing
-                nullptr, nullptr, nullptr, nullptr);
+                nullptr, nullptr, &annot_cb, this);
 
-        if(param.split_pages)
+        if(param.split_pages && ((param.page_bundle_size <= 0) || ((i - param.first_page + 1) % param.page_bundle_size == 0)))
         {
             delete f_curpage;
             f_curpage = nullptr;
         }
     }
+    // the last bundle, or the processing is stopped
+    if(param.split_pages)
+    {
+        delete f_curpage;
+        f_curpage = nullptr;
+    }
     if(page_count >= 0)
         cerr << "Working: " << page_count << "/" << page_count;
     cerr << endl;
@@ -162,8 +189,21 @@ void HTMLRenderer::process(PDFDoc *doc)
     if(param.process_outline)
         process_outline();
 
+    if(param.thumbnail_width > 0)
+        dump_thumbnail_index();
+
+    if(param.search_index)
+        dump_search_index();
+
     post_process();
 
+    // remove extracted images that are eventually rendered in the background
+    for(auto & p : extracted_image_files)
+    {
+        if(!param.embed_image && !p.second.used)
+            tmp_files.add(param.dest_dir + "/" + p.second.filename);
+    }
+
     bg_renderer = nullptr;
     fallback_bg_renderer = nullptr;
 
@@ -172,6 +212,7 @@ void HTMLRenderer::process(PDFDoc *doc)
 
 void HTMLRenderer::setDefaultCTM(double *ctm)
 {
+    OutputDev::setDefaultCTM(ctm);
     memcpy(default_ctm, ctm, sizeof(default_ctm));
 }
 
@@ -179,6 +220,9 @@ void HTMLRenderer::startPage(int pageNum, GfxState *state, XRef * xref)
 {
     covered_text_detector.reset();
     tracer.reset(state);
+    reset_page_image();
+    drawing_annotations = false;
+    thumbnail_texts.clear();
 
     this->pageNum = pageNum;
 
@@ -188,6 +232,13 @@ void HTMLRenderer::startPage(int pageNum, GfxState *state, XRef * xref)
 }
 
 void HTMLRenderer::endPage() {
+    if(!param.text_json.empty())
+    {
+        html_text_page.dump_json(*f_text_json, pageNum);
+        html_text_page.clear();
+        return;
+    }
+
     long long wid = all_manager.width.install(html_text_page.get_width());
     long long hid = all_manager.height.install(html_text_page.get_height());
 
@@ -203,40 +254,52 @@ void HTMLRenderer::endPage() {
             << " " << CSS::HEIGHT_CN << hid
             << "\">";
 
-    /*
-     * When split_pages is on, f_curpage points to the current page file
-     * and we want to output empty frames in f_pages.fs
-     */
-    if(param.split_pages)
-    {
-        f_pages.fs
-            << "<div id=\"" << CSS::PAGE_FRAME_CN << pageNum
-                << "\" class=\"" << CSS::PAGE_FRAME_CN
-                << " " << CSS::WIDTH_CN << wid
-                << " " << CSS::HEIGHT_CN << hid
-                << "\" data-page-no=\"" << pageNum
-                << "\" data-page-url=\"";
-
-        writeAttribute(f_pages.fs, cur_page_filename);
-        f_pages.fs << "\">";
-    }
-
     if(param.process_nontext)
     {
-        if (bg_renderer->render_page(cur_doc, pageNum))
+        if (embed_page_image())
         {
-            bg_renderer->embed_image(pageNum);
+            // the original image of the page is used, see image.cc
         }
-        else if (fallback_bg_renderer)
+        else
         {
-            if (fallback_bg_renderer->render_page(cur_doc, pageNum))
-                fallback_bg_renderer->embed_image(pageNum);
+            finish_css_drawings();
+            finish_extracted_images();
+            BackgroundRenderer * renderer = nullptr;
+            if (bg_renderer->render_page(cur_doc, pageNum))
+            {
+                renderer = bg_renderer.get();
+            }
+            else if (fallback_bg_renderer)
+            {
+                if (fallback_bg_renderer->render_page(cur_doc, pageNum))
+                    renderer = fallback_bg_renderer.get();
+            }
+            if (renderer)
+            {
+                renderer->embed_image(pageNum);
+
+                if (param.thumbnail_width > 0)
+                {
+                    string fn = renderer->dump_thumbnail(pageNum);
+                    if (!fn.empty())
+                        thumbnail_files.push_back(make_pair(pageNum, fn));
+                }
+            }
+            dump_css_drawings(*f_curpage);
+            dump_extracted_images(*f_curpage);
         }
     }
 
     // dump all text
     html_text_page.dump_text(*f_curpage);
     html_text_page.dump_css(f_css.fs);
+    if(param.search_index)
+    {
+        vector<vector<Unicode>> lines;
+        html_text_page.get_plain_text(lines);
+        for(size_t i = 0; i < lines.size(); ++i)
+            search_index.add_line(pageNum, i, lines[i]);
+    }
     html_text_page.clear();
 
     // process form
@@ -270,9 +333,32 @@ void HTMLRenderer::endPage() {
     // close page
     (*f_curpage) << "</div>" << endl;
 
+    /*
+     * When split_pages is on, f_curpage points to the current page file
+     * and we want to output empty frames in f_pages.fs
+     */
     if(param.split_pages)
     {
-        f_pages.fs << "</div>" << endl;
+        f_pages.fs
+            << "<div id=\"" << CSS::PAGE_FRAME_CN << pageNum
+                << "\" class=\"" << CSS::PAGE_FRAME_CN
+                << " " << CSS::WIDTH_CN << wid
+                << " " << CSS::HEIGHT_CN << hid
+                << "\" data-page-no=\"" << pageNum
+                << "\" data-page-url=\"";
+
+        writeAttribute(f_pages.fs, cur_page_filename);
+        f_pages.fs << "\"";
+
+        if(param.page_bundle_size > 0)
+        {
+            // the byte range of the page in the bundle, in hex as other numbers
+            long long page_end = f_curpage->tellp();
+            f_pages.fs << " data-page-offset=\"" << cur_page_offset
+                << "\" data-page-size=\"" << (page_end - cur_page_offset) << "\"";
+        }
+
+        f_pages.fs << "></div>" << endl;
     }
 }
 
@@ -280,6 +366,15 @@ void HTMLRenderer::pre_process(PDFDoc * doc)
 {
     preprocessor.process(doc);
 
+    // index the pages for link destinations, see get_linkdest_pageno()
+    page_numbers_by_ref.clear();
+    named_dests.clear();
+    for(int i = 1; i <= doc->getNumPages(); ++i)
+    {
+        if(auto * ref = cur_catalog->getPageRef(i))
+            page_numbers_by_ref.insert(std::make_pair(hash_ref(ref), i));
+    }
+
     /*
      * determine scale factors
      */
@@ -307,6 +402,25 @@ void HTMLRenderer::pre_process(PDFDoc * doc)
         text_scale_factor2 = zoom / text_scale_factor1;
     }
 
+    // only the text lines are written for --text-json, without HTML or CSS
+    if(!param.text_json.empty())
+    {
+        if(param.text_json == "-")
+        {
+            f_text_json = &std::cout;
+        }
+        else
+        {
+            auto fn = str_fmt("%s/%s", param.dest_dir.c_str(), param.text_json.c_str());
+            f_text_json_file.open((char*)fn, ofstream::binary);
+            if(!f_text_json_file)
+                throw string("Cannot open ") + (char*)fn + " for writing";
+            f_text_json = &f_text_json_file;
+        }
+        f_curpage = nullptr;
+        return;
+    }
+
     // we may output utf8 characters, so always use binary
     {
         /*
@@ -381,8 +495,54 @@ void HTMLRenderer::pre_process(PDFDoc * doc)
     }
 }
 
+/*
+ * A JSON array of thumbnails, e.g. [{"page":1,"file":"thumb1.png"}]
+ */
+void HTMLRenderer::dump_thumbnail_index()
+{
+    auto fn = str_fmt("%s/%s", param.dest_dir.c_str(), param.thumbnail_index_filename.c_str());
+    ofstream out((char*)fn, ofstream::binary);
+    if(!out)
+        throw string("Cannot open ") + (char*)fn + " for writing";
+
+    out << "[";
+    for(size_t i = 0; i < thumbnail_files.size(); ++i)
+    {
+        if(i > 0)
+            out << ",";
+        out << "{\"page\":" << thumbnail_files[i].first << ",\"file\":\"";
+        writeJSON(out, thumbnail_files[i].second);
+        out << "\"}";
+    }
+    out << "]" << endl;
+}
+
+/*
+ * See SearchIndex::dump()
+ */
+void HTMLRenderer::dump_search_index()
+{
+    auto fn = str_fmt("%s/%s", param.dest_dir.c_str(), param.search_index_filename.c_str());
+    ofstream out((char*)fn, ofstream::binary);
+    if(!out)
+        throw string("Cannot open ") + (char*)fn + " for writing";
+
+    search_index.dump(out);
+    out << endl;
+}
+
 void HTMLRenderer::post_process(void)
 {
+    if(!param.text_json.empty())
+    {
+        f_text_json->flush();
+        if(f_text_json_file.is_open())
+            f_text_json_file.close();
+        if(!(*f_text_json))
+            throw string("Cannot write ") + param.text_json;
+        return;
+    }
+
     dump_css();
     
     // close files if they opened
@@ -470,6 +630,15 @@ void HTMLRenderer::post_process(void)
                     output.clear(); // output will set fail big if fin is empty
                 }
             }
+            else if (line == "$search_index")
+            {
+                if (param.search_index)
+                {
+                    output << "<meta name=\"pdf2htmlEX-search-index\" content=\"";
+                    writeAttribute(output, param.search_index_filename);
+                    output << "\"/>" << endl;
+                }
+            }
             else if (line == "$pages")
             {
                 ifstream fin(f_pages.path, ifstream::binary);
@@ -504,6 +673,7 @@ void HTMLRenderer::dump_css (void)
     all_manager.stroke_color    .dump_css(f_css.fs);
     all_manager.word_space      .dump_css(f_css.fs);
     all_manager.whitespace      .dump_css(f_css.fs);
+    all_manager.vertical_whitespace.dump_css(f_css.fs);
     all_manager.fill_color      .dump_css(f_css.fs);
     all_manager.font_size       .dump_css(f_css.fs);
     all_manager.bottom          .dump_css(f_css.fs);
@@ -511,6 +681,7 @@ void HTMLRenderer::dump_css (void)
     all_manager.width           .dump_css(f_css.fs);
     all_manager.left            .dump_css(f_css.fs);
     all_manager.bgimage_size    .dump_css(f_css.fs);
+    all_manager.shape_background.dump_css(f_css.fs);
 
     // print css
     if(param.printing)
@@ -523,6 +694,7 @@ void HTMLRenderer::dump_css (void)
         all_manager.stroke_color    .dump_print_css(f_css.fs, ps);
         all_manager.word_space      .dump_print_css(f_css.fs, ps);
         all_manager.whitespace      .dump_print_css(f_css.fs, ps);
+        all_manager.vertical_whitespace.dump_print_css(f_css.fs, ps);
         all_manager.fill_color      .dump_print_css(f_css.fs, ps);
         all_manager.font_size       .dump_print_css(f_css.fs, ps);
         all_manager.bottom          .dump_print_css(f_css.fs, ps);
@@ -530,6 +702,7 @@ void HTMLRenderer::dump_css (void)
         all_manager.width           .dump_print_css(f_css.fs, ps);
         all_manager.left            .dump_print_css(f_css.fs, ps);
         all_manager.bgimage_size    .dump_print_css(f_css.fs, ps);
+        all_manager.shape_background.dump_print_css(f_css.fs, ps);
         f_css.fs << "}" << endl;
     }
 }
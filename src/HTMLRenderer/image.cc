@@ -7,14 +7,41 @@
  * 2012.08.14
  */
 
+#include <algorithm>
+#include <cstring>
+
 #include "HTMLRenderer.h"
+#include "Base64Stream.h"
 #include "util/namespace.h"
+#include "util/math.h"
+#include "util/path.h"
+#include "util/image.h"
+#include "util/encoding.h"
+#include "util/css_const.h"
 
 namespace pdf2htmlEX {
 
+using std::any_of;
+using std::vector;
+using std::pair;
+using std::ostream;
+using std::cerr;
+
+// bbox of an image in device space
+static void get_image_bbox(GfxState * state, double * bbox)
+{
+    bbox[0] = bbox[1] = 0;
+    bbox[2] = bbox[3] = 1;
+    tm_transform_bbox(state->getCTM(), bbox);
+}
+
 void HTMLRenderer::drawImage(GfxState * state, Object * ref, Stream * str, int width, int height, GfxImageColorMap * colorMap, GBool interpolate, int *maskColors, GBool inlineImg)
 {
     tracer.draw_image(state);
+    check_gray(colorMap->getColorSpace());
+
+    check_page_image(state, ref, str, width, height, colorMap, maskColors, inlineImg);
+    check_extracted_image(state, ref, str, width, height, colorMap, maskColors, inlineImg);
 
     return OutputDev::drawImage(state,ref,str,width,height,colorMap,interpolate,maskColors,inlineImg);
 
@@ -74,10 +101,580 @@ void HTMLRenderer::drawSoftMaskedImage(GfxState *state, Object *ref, Stream *str
                    GBool maskInterpolate)
 {
     tracer.draw_image(state);
+    check_gray(colorMap->getColorSpace());
+    {
+        double bbox[4];
+        get_image_bbox(state, bbox);
+        background_drawn(state, bbox);
+    }
 
     return OutputDev::drawSoftMaskedImage(state,ref,str, // TODO really required?
             width,height,colorMap,interpolate,
             maskStr, maskWidth, maskHeight, maskColorMap, maskInterpolate);
 }
 
+void HTMLRenderer::drawImageMask(GfxState *state, Object *ref, Stream *str,
+                   int width, int height, GBool invert,
+                   GBool interpolate, GBool inlineImg)
+{
+    check_gray(state->getFillColorSpace(), state->getFillColor());
+    {
+        double bbox[4];
+        get_image_bbox(state, bbox);
+        background_drawn(state, bbox);
+    }
+
+    return OutputDev::drawImageMask(state,ref,str,width,height,invert,interpolate,inlineImg);
+}
+
+void HTMLRenderer::drawMaskedImage(GfxState *state, Object *ref, Stream *str,
+                   int width, int height,
+                   GfxImageColorMap *colorMap,
+                   GBool interpolate,
+                   Stream *maskStr,
+                   int maskWidth, int maskHeight,
+                   GBool maskInvert, GBool maskInterpolate)
+{
+    check_gray(colorMap->getColorSpace());
+    {
+        double bbox[4];
+        get_image_bbox(state, bbox);
+        background_drawn(state, bbox);
+    }
+
+    return OutputDev::drawMaskedImage(state,ref,str,
+            width,height,colorMap,interpolate,
+            maskStr, maskWidth, maskHeight, maskInvert, maskInterpolate);
+}
+
+void HTMLRenderer::setSoftMask(GfxState *state, double *bbox, GBool alpha,
+                   Function *transferFunc, GfxColor *backdropColor)
+{
+    page_image.usable = false;
+    soft_mask_active = true;
+}
+
+void HTMLRenderer::clearSoftMask(GfxState *state)
+{
+    soft_mask_active = false;
+}
+
+void HTMLRenderer::beginTransparencyGroup(GfxState *state, double *bbox,
+                   GfxColorSpace *blendingColorSpace,
+                   GBool isolated, GBool knockout,
+                   GBool forSoftMask)
+{
+    ++ transparency_group_depth;
+}
+
+void HTMLRenderer::endTransparencyGroup(GfxState *state)
+{
+    -- transparency_group_depth;
+}
+
+void HTMLRenderer::dump_image_element(ostream & out, const string & css_class, const string & filename,
+        double left, double bottom, double width, double height,
+        const vector<pair<string, double>> & srcset)
+{
+    string fn = filename;
+    auto * image = find_duplicate_image(filename);
+    if(image)
+        fn = image->filename;
+    else if(param.embed_image)
+    {
+        // it is not known yet whether the image will be used again
+        image = find_image_file(filename);
+    }
+
+    if(image && param.embed_image)
+    {
+        // embed the data once in a CSS class, and refer to it, even from the first occurrence
+        if(image->css_id < 0)
+        {
+            image->css_id = image_data_count ++;
+
+            auto path = param.tmp_dir + "/" + image->filename;
+            ifstream fin(path, ifstream::binary);
+            if(!fin)
+                throw string("Cannot read image ") + path;
+
+            f_css.fs << "." << CSS::IMAGE_DATA_CN << image->css_id
+                << "{background:url(\"data:" << get_image_mime_type(image->filename) << ";base64," << Base64Stream(fin)
+                << "\") no-repeat;background-size:100% 100%;}" << endl;
+        }
+
+        out << "<div class=\"" << css_class
+            << " " << CSS::IMAGE_DATA_CN    << image->css_id
+            << " " << CSS::LEFT_CN          << all_manager.left.install(left)
+            << " " << CSS::BOTTOM_CN        << all_manager.bottom.install(bottom)
+            << " " << CSS::WIDTH_CN         << all_manager.width.install(width)
+            << " " << CSS::HEIGHT_CN        << all_manager.height.install(height)
+            << "\"></div>";
+        return;
+    }
+
+    out << "<img class=\"" << css_class
+        << " " << CSS::LEFT_CN      << all_manager.left.install(left)
+        << " " << CSS::BOTTOM_CN    << all_manager.bottom.install(bottom)
+        << " " << CSS::WIDTH_CN     << all_manager.width.install(width)
+        << " " << CSS::HEIGHT_CN    << all_manager.height.install(height)
+        << "\" alt=\"\" src=\"";
+
+    if(param.embed_image)
+    {
+        auto path = param.tmp_dir + "/" + fn;
+        ifstream fin(path, ifstream::binary);
+        if(!fin)
+            throw string("Cannot read image ") + path;
+
+        out << "data:" << get_image_mime_type(fn) << ";base64," << Base64Stream(fin);
+    }
+    else
+    {
+        writeAttribute(out, fn);
+
+        if(!srcset.empty())
+        {
+            out << "\" srcset=\"";
+            for(size_t i = 0; i < srcset.size(); ++i)
+            {
+                string src = fn;
+                if(srcset[i].first != filename)
+                {
+                    auto * d = find_duplicate_image(srcset[i].first);
+                    src = d ? d->filename : srcset[i].first;
+                }
+                if(i > 0)
+                    out << ", ";
+                writeAttribute(out, src);
+                out << " " << std::round(srcset[i].second * 1000) / 1000 << "x";
+            }
+        }
+    }
+    out << "\"/>";
+}
+
+string HTMLRenderer::get_image_mime_type(const string & filename)
+{
+    string format = get_suffix(filename).substr(1);
+    auto iter = FORMAT_MIME_TYPE_MAP.find(format);
+    if(iter == FORMAT_MIME_TYPE_MAP.end())
+        throw string("Image format not supported: ") + format;
+    return iter->second;
+}
+
+HTMLRenderer::ImageFile * HTMLRenderer::find_duplicate_image(const string & filename)
+{
+    if(!param.dedup_image)
+        return nullptr;
+
+    auto path = (param.embed_image ? param.tmp_dir : param.dest_dir) + "/" + filename;
+
+    auto digest_iter = image_file_digests.find(filename);
+    if(digest_iter == image_file_digests.end())
+    {
+        string digest;
+        if(!get_file_digest(path, digest))
+            return nullptr;
+        digest_iter = image_file_digests.insert(make_pair(filename, digest)).first;
+    }
+
+    // formats are distinguished, as the suffix decides the MIME type
+    auto p = image_files.insert(make_pair(digest_iter->second + get_suffix(filename), ImageFile{filename, -1}));
+    if(p.second)
+        return nullptr;
+
+    if(p.first->second.filename != filename)
+    {
+        // the digest may collide, so the content is compared before the file is replaced
+        auto dup_path = (param.embed_image ? param.tmp_dir : param.dest_dir) + "/" + p.first->second.filename;
+        if(!same_file_content(path, dup_path))
+            return nullptr;
+
+        tmp_files.add(path);
+    }
+
+    return &(p.first->second);
+}
+
+HTMLRenderer::ImageFile * HTMLRenderer::find_image_file(const string & filename)
+{
+    auto digest_iter = image_file_digests.find(filename);
+    if(digest_iter == image_file_digests.end())
+        return nullptr;
+
+    auto iter = image_files.find(digest_iter->second + get_suffix(filename));
+    if((iter == image_files.end()) || (iter->second.filename != filename))
+        return nullptr;
+
+    return &(iter->second);
+}
+
+void HTMLRenderer::reset_page_image()
+{
+    page_image.type = PageImage::NONE;
+    page_image.usable = true;
+
+    page_image_elements.clear();
+    css_drawings.clear();
+    clip_is_rect = true;
+    clip_is_rect_stack.clear();
+    background_bboxes.clear();
+    transparency_group_depth = 0;
+    soft_mask_active = false;
+    page_gray = true;
+}
+
+void HTMLRenderer::background_drawn(GfxState * state, const double * bbox)
+{
+    page_image.usable = false;
+    add_background_bbox(state, bbox);
+}
+
+static bool is_gray_color_space(GfxColorSpace * cs)
+{
+    switch(cs->getMode())
+    {
+        case csDeviceGray:
+        case csCalGray:
+            return true;
+        case csICCBased:
+            return (cs->getNComps() == 1);
+        case csIndexed:
+            return is_gray_color_space(((GfxIndexedColorSpace*)cs)->getBase());
+        case csSeparation:
+            return is_gray_color_space(((GfxSeparationColorSpace*)cs)->getAlt());
+        default:
+            return false;
+    }
+}
+
+void HTMLRenderer::check_gray(GfxColorSpace * cs, GfxColor * color)
+{
+    if(!page_gray || (cs == nullptr) || is_gray_color_space(cs))
+        return;
+
+    // a solid color might be gray in any color space
+    if((color != nullptr) && (cs->getMode() != csPattern))
+    {
+        GfxRGB rgb;
+        cs->getRGB(color, &rgb);
+        if((rgb.r == rgb.g) && (rgb.g == rgb.b))
+            return;
+    }
+
+    page_gray = false;
+}
+
+void HTMLRenderer::add_background_bbox(GfxState * state, const double * bbox)
+{
+    if(!param.extract_image && !param.css_draw)
+        return;
+
+    double clip_bbox[4];
+    state->getClipBBox(&clip_bbox[0], &clip_bbox[1], &clip_bbox[2], &clip_bbox[3]);
+
+    double result[4];
+    if(bbox == nullptr)
+        memcpy(result, clip_bbox, sizeof(result));
+    else if(!bbox_intersect(bbox, clip_bbox, result))
+        return;
+
+    background_bboxes.insert(background_bboxes.end(), result, result + 4);
+}
+
+/*
+ * Images are put into separate elements only when they look the same as in the background,
+ * i.e. drawn upright, opaquely, and the part inside the page is not clipped
+ */
+bool HTMLRenderer::get_image_placement(GfxState * state, double * bbox)
+{
+    if(!equal(state->getFillOpacity(), 1) || (state->getBlendMode() != gfxBlendNormal)
+       || soft_mask_active || (transparency_group_depth > 0))
+        return false;
+
+    const double * ctm = state->getCTM();
+    if(!(equal(ctm[1], 0) && equal(ctm[2], 0) && is_positive(ctm[0]) && is_positive(ctm[3])))
+        return false;
+
+    bbox[0] = ctm[4];
+    bbox[1] = ctm[5];
+    bbox[2] = ctm[4] + ctm[0];
+    bbox[3] = ctm[5] + ctm[3];
+
+    // allow an error of 1px, as clipping paths are usually set to the image/page boundaries
+    double page_bbox[4] = { 0, 0, state->getPageWidth(), state->getPageHeight() };
+    double visible_bbox[4];
+    if(!bbox_intersect(bbox, page_bbox, visible_bbox))
+        return false;
+
+    double clip_bbox[4];
+    state->getClipBBox(&clip_bbox[0], &clip_bbox[1], &clip_bbox[2], &clip_bbox[3]);
+    if((clip_bbox[0] > visible_bbox[0] + 1) || (clip_bbox[1] > visible_bbox[1] + 1)
+       || (clip_bbox[2] < visible_bbox[2] - 1) || (clip_bbox[3] < visible_bbox[3] - 1))
+        return false;
+
+    return true;
+}
+
+/*
+ * Called for every image drawn on the page
+ * The image is recorded if it can be used as the background directly, which requires
+ * - it is the first thing drawn into the background
+ * - it is an image XObject, whose stream is either a RGB/Gray JPEG, or 1-bit JBIG2/CCITT data
+ * - see also get_image_placement()
+ */
+void HTMLRenderer::check_page_image(GfxState * state, Object * ref, Stream * str, int width, int height,
+        GfxImageColorMap * colorMap, int * maskColors, GBool inlineImg)
+{
+    if(!param.bg_passthrough || !page_image.usable)
+        return;
+
+    // in any case, nothing else can be drawn later
+    page_image.usable = false;
+
+    if((page_image.type != PageImage::NONE)
+       || inlineImg || maskColors
+       || (ref == nullptr) || (!ref->isRef()))
+        return;
+
+    double bbox[4];
+    if(!get_image_placement(state, bbox))
+        return;
+
+    if(is_passthrough_jpeg(str))
+    {
+        page_image.type = PageImage::JPEG;
+    }
+    else if(((str->getKind() == strJBIG2) || (str->getKind() == strCCITTFax))
+            && (colorMap->getNumPixelComps() == 1) && (colorMap->getBits() == 1)
+            && (colorMap->getColorSpace()->getMode() == csDeviceGray))
+    {
+        page_image.type = PageImage::BILEVEL;
+        Guchar zero = 0;
+        GfxGray gray;
+        colorMap->getGray(&zero, &gray);
+        page_image.invert = (colToDbl(gray) > 0.5);
+    }
+    else
+    {
+        return;
+    }
+
+    page_image.usable = true;
+    page_image.ref = ref->getRef();
+    page_image.width = width;
+    page_image.height = height;
+    memcpy(page_image.bbox, bbox, sizeof(bbox));
+}
+
+bool HTMLRenderer::embed_page_image()
+{
+    if(!param.bg_passthrough || param.fallback || param.proof
+       || (page_image.type == PageImage::NONE) || !page_image.usable)
+        return false;
+
+    // covered texts would be drawn into the background
+    if(param.correct_text_visibility)
+    {
+        const auto & chars_covered = covered_text_detector.get_chars_covered();
+        if(any_of(chars_covered.begin(), chars_covered.end(), [](bool b) { return b; }))
+            return false;
+    }
+
+    const char * format = (page_image.type == PageImage::JPEG) ? "jpg" : "png";
+    string fn = (char*)str_fmt("bg%x.%s", pageNum, format);
+    string path = (param.embed_image ? param.tmp_dir : param.dest_dir) + "/" + fn;
+
+    double width = page_image.bbox[2] - page_image.bbox[0];
+    double height = page_image.bbox[3] - page_image.bbox[1];
+
+    bool ok = false;
+    Object obj;
+    xref->fetch(page_image.ref.num, page_image.ref.gen, &obj);
+    if(obj.isStream())
+    {
+        if(page_image.type == PageImage::JPEG)
+        {
+            ok = dump_jpeg_stream(obj.getStream(), path);
+        }
+        else
+        {
+            // the resolution of the image on the page
+            double h_dpi = page_image.width * text_zoom_factor() * DEFAULT_DPI / width;
+            double v_dpi = page_image.height * text_zoom_factor() * DEFAULT_DPI / height;
+            ok = dump_bilevel_png(obj.getStream(), page_image.width, page_image.height, page_image.invert, h_dpi, v_dpi, path);
+        }
+    }
+    obj.free();
+
+    if(param.embed_image || !ok)
+        tmp_files.add(path);
+
+    if(!ok)
+    {
+        cerr << "Cannot dump the image of page " << pageNum << ", render it as usual" << endl;
+        return false;
+    }
+
+    dump_image_element(*f_curpage, CSS::BACKGROUND_IMAGE_CN, fn,
+            page_image.bbox[0], page_image.bbox[1], width, height);
+
+    return true;
+}
+
+bool HTMLRenderer::is_image_extracted(const string & key)
+{
+    return extracted_image_keys.count(key) > 0;
+}
+
+/*
+ * Called for every image drawn by drawImage()
+ * The image is dumped into a file (once for all pages) if
+ * - it is an image XObject without color key masking
+ * - see also get_image_placement()
+ * Otherwise it is rendered in the background
+ */
+void HTMLRenderer::check_extracted_image(GfxState * state, Object * ref, Stream * str, int width, int height,
+        GfxImageColorMap * colorMap, int * maskColors, GBool inlineImg)
+{
+    if(!param.extract_image)
+        return;
+
+    PageImageElement element;
+    element.drawing_index = background_bboxes.size() / 4;
+    if((ref != nullptr) && ref->isRef())
+        element.key = get_image_key(ref->getRef(), state->getCTM(), getDefICTM());
+
+    // annotations hidden in the background are drawn here anyway
+    bool extractable = (!param.fallback) && (!param.proof)
+        && (!drawing_annotations || param.process_annotation)
+        && (!inlineImg) && (!maskColors)
+        && (ref != nullptr) && ref->isRef()
+        && get_image_placement(state, element.bbox);
+
+    if(extractable)
+    {
+        Ref r = ref->getRef();
+        auto & file = extracted_image_files[hash_ref(&r)];
+        if(file.filename.empty())
+        {
+            // "i" for "Image"
+            // JPEG is passed through if possible, otherwise the image is decoded into PNG
+            bool is_jpeg = is_passthrough_jpeg(str);
+            string fn = (char*)str_fmt("i%llx.%s", hash_ref(&r), (is_jpeg ? "jpg" : "png"));
+            string path = (param.embed_image ? param.tmp_dir : param.dest_dir) + "/" + fn;
+
+            bool ok;
+            if(is_jpeg)
+            {
+                ok = dump_jpeg_stream(str, path);
+            }
+            else
+            {
+                double h_dpi = width * text_zoom_factor() * DEFAULT_DPI / (element.bbox[2] - element.bbox[0]);
+                double v_dpi = height * text_zoom_factor() * DEFAULT_DPI / (element.bbox[3] - element.bbox[1]);
+                ok = dump_png_image(str, width, height, colorMap, h_dpi, v_dpi, path);
+            }
+
+            if(param.embed_image || !ok)
+                tmp_files.add(path);
+
+            if(ok)
+            {
+                file.filename = fn;
+                file.used = false;
+            }
+            else
+            {
+                extracted_image_files.erase(hash_ref(&r));
+                extractable = false;
+            }
+        }
+
+        if(extractable)
+        {
+            element.filename = file.filename;
+            element.id = hash_ref(&r);
+        }
+    }
+
+    if(!extractable)
+    {
+        double bbox[4];
+        get_image_bbox(state, bbox);
+        add_background_bbox(state, bbox);
+    }
+
+    page_image_elements.push_back(element);
+}
+
+/*
+ * An image cannot be extracted if anything in the background is drawn over it,
+ * including images that cannot be extracted due to the same reason.
+ */
+void HTMLRenderer::finish_extracted_images()
+{
+    extracted_image_keys.clear();
+    if(!param.extract_image)
+        return;
+
+    size_t background_count = background_bboxes.size() / 4;
+    // bboxes of images drawn in the background, in reversed drawing order
+    vector<const double *> background_images;
+    for(auto iter = page_image_elements.rbegin(); iter != page_image_elements.rend(); ++iter)
+    {
+        auto & element = *iter;
+        if(element.filename.empty())
+            continue;
+
+        bool covered = false;
+        for(size_t i = element.drawing_index; (!covered) && (i < background_count); ++i)
+            covered = bbox_intersect(element.bbox, &background_bboxes[i * 4]);
+        for(size_t i = 0; (!covered) && (i < background_images.size()); ++i)
+            covered = bbox_intersect(element.bbox, background_images[i]);
+        // CSS drawings rendered in the background, see finish_css_drawings()
+        for(size_t i = 0; (!covered) && (i < css_drawings.size()); ++i)
+            covered = (!css_drawings[i].visible) && (css_drawings[i].drawing_index >= element.drawing_index)
+                && bbox_intersect(element.bbox, css_drawings[i].bbox);
+
+        if(covered)
+        {
+            element.filename.clear();
+            background_images.push_back(element.bbox);
+        }
+    }
+
+    for(auto & element : page_image_elements)
+    {
+        if(!element.filename.empty())
+            extracted_image_keys.insert(element.key);
+    }
+    // the same image might be drawn at the same place more than once
+    for(auto & element : page_image_elements)
+    {
+        if(element.filename.empty() && !element.key.empty())
+            extracted_image_keys.erase(element.key);
+    }
+    for(auto & element : page_image_elements)
+    {
+        if(!element.filename.empty() && !extracted_image_keys.count(element.key))
+            element.filename.clear();
+    }
+}
+
+void HTMLRenderer::dump_extracted_images(ostream & out)
+{
+    for(auto & element : page_image_elements)
+    {
+        if(element.filename.empty())
+            continue;
+
+        extracted_image_files[element.id].used = true;
+        dump_image_element(out, CSS::BACKGROUND_IMAGE_CN, element.filename,
+                element.bbox[0], element.bbox[1],
+                element.bbox[2] - element.bbox[0], element.bbox[3] - element.bbox[1]);
+    }
+}
+
 } // namespace pdf2htmlEX
@@ -34,19 +34,8 @@ using std::endl;
  * The string will be put into a HTML attribute, surrounded by single quotes
  * So pay attention to the characters used here
  */
-static string get_linkdest_detail_str(LinkDest * dest, Catalog * catalog, int & pageno)
+static string get_linkdest_detail_str(LinkDest * dest, int pageno)
 {
-    pageno = 0;
-    if(dest->isPageRef())
-    {
-        auto pageref = dest->getPageRef();
-        pageno = catalog->findPage(pageref.num, pageref.gen);
-    }
-    else
-    {
-        pageno = dest->getPageNum();
-    }
-
     if(pageno <= 0)
     {
         return "";
@@ -129,6 +118,26 @@ static string get_linkdest_detail_str(LinkDest * dest, Catalog * catalog, int &
     return sout.str();
 }
 
+int HTMLRenderer::get_linkdest_pageno(LinkDest * dest)
+{
+    if(dest->isPageRef())
+    {
+        auto pageref = dest->getPageRef();
+        auto iter = page_numbers_by_ref.find(hash_ref(&pageref));
+        return (iter == page_numbers_by_ref.end()) ? 0 : iter->second;
+    }
+    return dest->getPageNum();
+}
+
+LinkDest * HTMLRenderer::find_named_dest(GooString * name)
+{
+    string key(name->getCString(), name->getLength());
+    auto iter = named_dests.find(key);
+    if(iter == named_dests.end())
+        iter = named_dests.insert(std::make_pair(key, std::unique_ptr<LinkDest>(cur_catalog->findDest(name)))).first;
+    return iter->second.get();
+}
+
 string HTMLRenderer::get_linkaction_str(LinkAction * action, string & detail)
 {
     string dest_str;
@@ -141,20 +150,20 @@ string HTMLRenderer::get_linkaction_str(LinkAction * action, string & detail)
             case actionGoTo:
                 {
                     auto * real_action = dynamic_cast<LinkGoTo*>(action);
+                    // owned by the action, or by named_dests
                     LinkDest * dest = nullptr;
                     if(auto _ = real_action->getDest())
-                        dest = _->copy();
+                        dest = _;
                     else if (auto _ = real_action->getNamedDest())
-                        dest = cur_catalog->findDest(_);
+                        dest = find_named_dest(_);
                     if(dest)
                     {
-                        int pageno = 0;
-                        detail = get_linkdest_detail_str(dest, cur_catalog, pageno);
+                        int pageno = get_linkdest_pageno(dest);
+                        detail = get_linkdest_detail_str(dest, pageno);
                         if(pageno > 0)
                         {
                             dest_str = (char*)str_fmt("#%s%x", CSS::PAGE_FRAME_CN, pageno);
                         }
-                        delete dest;
                     }
                 }
                 break;
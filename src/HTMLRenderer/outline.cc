@@ -8,6 +8,10 @@
  */
 
 #include <iostream>
+#include <sstream>
+#include <fstream>
+#include <vector>
+#include <memory>
 
 #include <Outline.h>
 #include <goo/GooList.h>
@@ -20,17 +24,49 @@
 namespace pdf2htmlEX {
 
 using std::ostream;
+using std::ostringstream;
+using std::ofstream;
+using std::vector;
+using std::unique_ptr;
 
+/*
+ * The tree is traversed with an explicit stack instead of recursion,
+ * such that very deep outlines cannot overflow the stack
+ *
+ * An item is kept open while its kids are being processed,
+ * since the kids are deleted by OutlineItem::close()
+ */
 void HTMLRenderer::process_outline_items(GooList * items)
 {
     if((!items) || (items->getLength() == 0))
         return;
 
+    struct Frame {
+        GooList * items;
+        int next_idx;
+        OutlineItem * parent;
+    };
+    vector<Frame> stack;
+
     f_outline.fs << "<ul>";
+    stack.push_back(Frame{items, 0, nullptr});
 
-    for(int i = 0; i < items->getLength(); ++i)
+    while(!stack.empty())
     {
-        OutlineItem * item = (OutlineItem*)(items->get(i));
+        auto & frame = stack.back();
+        if(frame.next_idx >= frame.items->getLength())
+        {
+            f_outline.fs << "</ul>";
+            if(frame.parent)
+            {
+                frame.parent->close();
+                f_outline.fs << "</li>";
+            }
+            stack.pop_back();
+            continue;
+        }
+
+        OutlineItem * item = (OutlineItem*)(frame.items->get(frame.next_idx++));
 
         string detail;
         string dest = get_linkaction_str(item->getAction(), detail);
@@ -51,24 +87,149 @@ void HTMLRenderer::process_outline_items(GooList * items)
 
         // check kids
         item->open();
-        if(item->hasKids())
+        GooList * kids = item->hasKids() ? item->getKids() : nullptr;
+        if(kids && (kids->getLength() > 0))
         {
-            process_outline_items(item->getKids());
+            f_outline.fs << "<ul>";
+            // `frame` is invalidated here
+            stack.push_back(Frame{kids, 0, item});
+        }
+        else
+        {
+            item->close();
+            f_outline.fs << "</li>";
         }
-        item->close();
-        f_outline.fs << "</li>";
     }
+}
 
-    f_outline.fs << "</ul>";
+/*
+ * Write the outline as JSON, to be built by pdf2htmlEX.js
+ *
+ * Each item is [title, href, detail, kids]
+ * - detail is the data-dest-detail of links, or null
+ * - kids is an array of items, or the URL of a JSON file of the array, or missing if there is no kid
+ *
+ * The top param.outline_chunk_depth levels are put into the data-outline attribute of an <ul>,
+ * and the kids below are written into separate files, which are split again in the same way.
+ * All files are written in a single pass, so at most one file is open for each of the nested chunks
+ */
+void HTMLRenderer::process_outline_json(GooList * items)
+{
+    if((!items) || (items->getLength() == 0))
+        return;
+
+    struct Frame {
+        GooList * items;
+        int next_idx;
+        OutlineItem * parent;
+        int depth; // depth of the items in the current chunk
+        ostream * out;
+        // set if the items start a new chunk, which is written to chunk_path when its items end,
+        // such that only one file is open at a time, however deep the outline is
+        unique_ptr<ostringstream> chunk_out;
+        string chunk_path;
+    };
+    vector<Frame> stack;
+
+    string prefix = param.outline_filename.empty() ? string("outline") : param.outline_filename;
+    int chunk_count = 0;
+
+    ostringstream top_out;
+    top_out << "[";
+    stack.push_back(Frame{items, 0, nullptr, 0, &top_out, nullptr, ""});
+
+    while(!stack.empty())
+    {
+        auto & frame = stack.back();
+        if(frame.next_idx >= frame.items->getLength())
+        {
+            (*frame.out) << "]";
+            if(frame.chunk_out)
+            {
+                ofstream chunk_file(frame.chunk_path, ofstream::binary);
+                if(!chunk_file)
+                    throw string("Cannot open ") + frame.chunk_path + " for writing";
+                chunk_file << frame.chunk_out->str();
+                chunk_file.close();
+                if(!chunk_file)
+                    throw string("Cannot write outline chunk");
+            }
+            else if(frame.parent)
+            {
+                // the end of the parent item
+                (*frame.out) << "]";
+            }
+
+            if(frame.parent)
+                frame.parent->close();
+            stack.pop_back();
+            continue;
+        }
+
+        ostream & out = *frame.out;
+        int depth = frame.depth;
+        if(frame.next_idx > 0)
+            out << ",";
+
+        OutlineItem * item = (OutlineItem*)(frame.items->get(frame.next_idx++));
+
+        string detail;
+        string dest = get_linkaction_str(item->getAction(), detail);
+
+        out << "[\"";
+        writeUnicodesJSON(out, item->getTitle(), item->getTitleLength());
+        out << "\",\"";
+        writeJSON(out, dest);
+        out << "\"," << (detail.empty() ? string("null") : detail);
+
+        // check kids
+        item->open();
+        GooList * kids = item->hasKids() ? item->getKids() : nullptr;
+        if(kids && (kids->getLength() > 0))
+        {
+            // `frame` is invalidated by push_back
+            if(depth + 1 >= param.outline_chunk_depth)
+            {
+                string chunk_filename = (char*)str_fmt("%s.%d.json", prefix.c_str(), ++chunk_count);
+                out << ",\"";
+                writeJSON(out, chunk_filename);
+                out << "\"]";
+
+                string chunk_path = (char*)str_fmt("%s/%s", param.dest_dir.c_str(), chunk_filename.c_str());
+                unique_ptr<ostringstream> chunk_out(new ostringstream);
+                (*chunk_out) << "[";
+
+                ostream * out_ptr = chunk_out.get();
+                stack.push_back(Frame{kids, 0, item, 0, out_ptr, std::move(chunk_out), chunk_path});
+            }
+            else
+            {
+                out << ",[";
+                stack.push_back(Frame{kids, 0, item, depth + 1, &out, nullptr, ""});
+            }
+        }
+        else
+        {
+            item->close();
+            out << "]";
+        }
+    }
+
+    f_outline.fs << "<ul data-outline=\"";
+    writeAttribute(f_outline.fs, top_out.str());
+    f_outline.fs << "\"></ul>";
 }
-   
+
 void HTMLRenderer::process_outline()
 {
     Outline * outline = cur_doc->getOutline();
     if(!outline)
         return;
 
-    process_outline_items(outline->getItems());
+    if(param.outline_chunk_depth > 0)
+        process_outline_json(outline->getItems());
+    else
+        process_outline_items(outline->getItems());
 }
 
 }// namespace pdf2htmlEX
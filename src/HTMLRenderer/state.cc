@@ -37,7 +37,11 @@ void HTMLRenderer::updateTextPos(GfxState * state)
 void HTMLRenderer::updateTextShift(GfxState * state, double shift) 
 {
     text_pos_changed = true;
-    cur_tx -= shift * 0.001 * state->getFontSize() * state->getHorizScaling(); 
+    auto font = state->getFont();
+    if(font && font->getWMode())
+        cur_ty -= shift * 0.001 * state->getFontSize();
+    else
+        cur_tx -= shift * 0.001 * state->getFontSize() * state->getHorizScaling(); 
 }
 void HTMLRenderer::updateFont(GfxState * state) 
 {
@@ -91,16 +95,19 @@ void HTMLRenderer::clip(GfxState * state)
 {
     clip_changed = true;
     tracer.clip(state);
+    update_clip_rect(state);
 }
 void HTMLRenderer::eoClip(GfxState * state)
 {
     clip_changed = true;
     tracer.clip(state, true);
+    update_clip_rect(state);
 }
 void HTMLRenderer::clipToStrokePath(GfxState * state)
 {
     clip_changed = true;
     tracer.clip_to_stroke_path(state);
+    clip_is_rect = false;
 }
 void HTMLRenderer::reset_state()
 {
@@ -122,6 +129,7 @@ void HTMLRenderer::reset_state()
     cur_line_state.x = 0;
     cur_line_state.y = 0;
     memcpy(cur_line_state.transform_matrix, ID_MATRIX, sizeof(cur_line_state.transform_matrix));
+    cur_line_state.vertical = false;
 
     cur_line_state.is_char_covered = [this](int index) { return is_char_covered(index);};
 
@@ -132,6 +140,7 @@ void HTMLRenderer::reset_state()
 
     cur_tx  = cur_ty  = 0;
     draw_tx = draw_ty = 0;
+    line_origin_y = 0;
 
     reset_state_change();
     all_changed = true;
@@ -188,6 +197,7 @@ void HTMLRenderer::check_state_change(GfxState * state)
     bool need_recheck_position = false;
     bool need_rescale_font = false;
     bool draw_text_scale_changed = false;
+    bool line_direction_changed = false;
 
     // save current info for later use
     auto old_text_state = cur_text_state;
@@ -223,6 +233,13 @@ void HTMLRenderer::check_state_change(GfxState * state)
             cur_text_state.font_info = new_font_info;
         }
 
+        if(new_font_info->is_vertical != cur_line_state.vertical)
+        {
+            line_direction_changed = true;
+            cur_line_state.vertical = new_font_info->is_vertical;
+            set_line_state(new_line_state, NLS_NEWLINE);
+        }
+
         /*
          * For Type 3 fonts, we need to take type3_font_size_scale into consideration
          */
@@ -361,7 +378,12 @@ void HTMLRenderer::check_state_change(GfxState * state)
                 inverted[3] =  old_tm[0] / det;
                 dx = inverted[0] * lhs1 + inverted[2] * lhs2;
                 dy = inverted[1] * lhs1 + inverted[3] * lhs2;
-                if(equal(dy, 0))
+                if(cur_line_state.vertical)
+                {
+                    // text in a same column, we can insert positive or negative y-offsets
+                    merged = equal(dx, 0);
+                }
+                else if(equal(dy, 0))
                 {
                     // text on a same horizontal line, we can insert positive or negative x-offsets
                     merged = true;
@@ -388,7 +410,15 @@ void HTMLRenderer::check_state_change(GfxState * state)
         }
         // else: different rotation: force new line
 
-        if(merged && !equal(state->getHorizScaling(), 0))
+        if(merged && cur_line_state.vertical)
+        {
+            // text flows downwards
+            html_text_page.get_cur_line()->append_offset(-dy * old_draw_text_scale);
+            cur_text_state.vertical_align = 0;
+            draw_tx = cur_tx;
+            draw_ty = cur_ty;
+        }
+        else if(merged && !equal(state->getHorizScaling(), 0))
         {
             html_text_page.get_cur_line()->append_offset(dx * old_draw_text_scale / state->getHorizScaling());
             if(equal(dy, 0))
@@ -415,10 +445,13 @@ void HTMLRenderer::check_state_change(GfxState * state)
     }
 
     // letter space
-    // depends: draw_text_scale
-    if(all_changed || letter_space_changed || draw_text_scale_changed)
+    // depends: draw_text_scale, line direction
+    if(all_changed || letter_space_changed || draw_text_scale_changed || line_direction_changed)
     {
         double new_letter_space = state->getCharSpace() * draw_text_scale;
+        // in writing mode, positive letter space moves the next char upwards
+        if(cur_line_state.vertical)
+            new_letter_space = -new_letter_space;
         if(!equal(new_letter_space, cur_text_state.letter_space))
         {
             cur_text_state.letter_space = new_letter_space;
@@ -427,10 +460,12 @@ void HTMLRenderer::check_state_change(GfxState * state)
     }
 
     // word space
-    // depends draw_text_scale
-    if(all_changed || word_space_changed || draw_text_scale_changed)
+    // depends draw_text_scale, line direction
+    if(all_changed || word_space_changed || draw_text_scale_changed || line_direction_changed)
     {
         double new_word_space = state->getWordSpace() * draw_text_scale;
+        if(cur_line_state.vertical)
+            new_word_space = -new_word_space;
         if(!equal(new_word_space, cur_text_state.word_space))
         {
             cur_text_state.word_space = new_word_space;
@@ -492,7 +527,7 @@ void HTMLRenderer::check_state_change(GfxState * state)
     reset_state_change();
 }
 
-void HTMLRenderer::prepare_text_line(GfxState * state)
+void HTMLRenderer::prepare_text_line(GfxState * state, double origin_y, double dx, double dy)
 {
     if(!(html_text_page.get_cur_line()))
         new_line_state = NLS_NEWCLIP;
@@ -506,7 +541,15 @@ void HTMLRenderer::prepare_text_line(GfxState * state)
     {
         // update position such that they will be recorded by text_line_buf
         double rise_x, rise_y;
-        state->textTransformDelta(0, state->getRise(), &rise_x, &rise_y);
+        double shift_y = state->getRise();
+        if(cur_line_state.vertical)
+        {
+            // (x,y) of a vertical line is the top center of the first char,
+            // where browsers put the ascent of the font, see HTMLTextLine::dump_text()
+            shift_y += (cur_text_state.font_info->ascent - origin_y) * state->getFontSize();
+            line_origin_y = origin_y;
+        }
+        state->textTransformDelta(dx, dy + shift_y, &rise_x, &rise_y);
         state->transform(state->getCurX() + rise_x, state->getCurY() + rise_y, &cur_line_state.x, &cur_line_state.y);
 
         if (param.correct_text_visibility)
@@ -522,13 +565,25 @@ void HTMLRenderer::prepare_text_line(GfxState * state)
     }
     else
     {
-        // align horizontal position
+        // align horizontal position (vertical position for vertical lines)
         // try to merge with the last line if possible
-        double target = (cur_tx - draw_tx) * draw_text_scale;
-        if(!equal(target, 0))
+        if(cur_line_state.vertical)
+        {
+            double target = (draw_ty - cur_ty) * draw_text_scale;
+            if(!equal(target, 0))
+            {
+                html_text_page.get_cur_line()->append_offset(target);
+                draw_ty -= target / draw_text_scale;
+            }
+        }
+        else
         {
-            html_text_page.get_cur_line()->append_offset(target);
-            draw_tx += target / draw_text_scale;
+            double target = (cur_tx - draw_tx) * draw_text_scale;
+            if(!equal(target, 0))
+            {
+                html_text_page.get_cur_line()->append_offset(target);
+                draw_tx += target / draw_text_scale;
+            }
         }
     }
 
@@ -20,6 +20,8 @@
 namespace pdf2htmlEX {
 
 using std::none_of;
+using std::min;
+using std::max;
 using std::cerr;
 using std::endl;
 
@@ -33,27 +35,42 @@ void HTMLRenderer::drawString(GfxState * state, GooString * s)
     double cur_word_space   = state->getWordSpace();
     double cur_horiz_scaling = state->getHorizScaling();
 
+    // texts might be drawn into the background, e.g. when covered
+    if((state->getRender() & 3) != 3)
+    {
+        check_gray(state->getFillColorSpace(), state->getFillColor());
+        check_gray(state->getStrokeColorSpace(), state->getStrokeColor());
+    }
+
+    // text used as clip path, see update_clip_rect()
+    if(state->getRender() >= 4)
+        clip_is_rect = false;
 
-    // Writing mode fonts and Type 3 fonts are rendered as images
-    // I don't find a way to display writing mode fonts in HTML except for one div for each character, which is too costly
+    // Type 3 fonts are rendered as images, as well as writing mode fonts if process_vertical_text is off
     // For type 3 fonts, due to the font matrix, still it's hard to show it on HTML
     if( (font == nullptr) 
-        || (font->getWMode())
+        || (font->getWMode() && !param.process_vertical_text)
         || ((font->getType() == fontType3) && (!param.process_type3))
       )
     {
+        // they are drawn into the background, unless invisible (render mode 3 or 7)
+        if((font != nullptr) && ((state->getRender() & 3) != 3))
+            background_drawn(state);
         return;
     }
 
-    // see if the line has to be closed due to state change
-    check_state_change(state);
-    prepare_text_line(state);
+    // text used as path is also drawn into the background
+    if((state->getRender() >= 4) && (state->getRender() != 7))
+        background_drawn(state);
 
     // Now ready to output
     // get the unicodes
     char *p = s->getCString();
     int len = s->getLength();
 
+    // text in writing mode flows downwards, with word space and letter space in the opposite direction
+    bool vertical = (font->getWMode() != 0);
+
     //accumulated displacement of chars in this string, in text object space
     double dx = 0;
     double dy = 0;
@@ -69,6 +86,22 @@ void HTMLRenderer::drawString(GfxState * state, GooString * s)
     CharCode code;
     Unicode *u = nullptr;
 
+    // a vertical line is positioned by the vertical origin of its first char
+    oy = 0;
+    if(vertical)
+        font->getNextChar(p, len, &code, &u, &uLen, &ax, &ay, &ox, &oy);
+
+    // see if the line has to be closed due to state change
+    check_state_change(state);
+    // or if the first char has another vertical origin than the line
+    if(vertical && !equal(oy, line_origin_y) && (new_line_state < NLS_NEWLINE))
+        new_line_state = NLS_NEWLINE;
+    prepare_text_line(state, oy);
+
+    //advance of current char along the line, in text object space, including letter space but not word space.
+    double advance;
+    double line_word_space = vertical ? -cur_word_space : cur_word_space;
+
     HR_DEBUG(printf("HTMLRenderer::drawString:len=%d\n", len));
 
     while (len > 0) 
@@ -76,12 +109,34 @@ void HTMLRenderer::drawString(GfxState * state, GooString * s)
         auto n = font->getNextChar(p, len, &code, &u, &uLen, &ax, &ay, &ox, &oy);
         HR_DEBUG(printf("HTMLRenderer::drawString:unicode=%lc(%d)\n", (wchar_t)u[0], u[0]));
 
-        if(!(equal(ox, 0) && equal(oy, 0)))
+        if(vertical)
         {
-            cerr << "TODO: non-zero origins" << endl;
+            // a vertical line is positioned by a single origin, so start a new one at this char
+            if(!equal(oy, line_origin_y))
+            {
+                new_line_state = NLS_NEWLINE;
+                prepare_text_line(state, oy, dx, dy);
+            }
+            // browsers center chars in vertical lines, which is the default horizontal origin
+            if(!vertical_origin_warned && font->isCIDFont() && !equal(ox, dynamic_cast<GfxCIDFont*>(font)->getWidth(p, n) / 2))
+            {
+                cerr << "Warning: vertical text with horizontal origins other than the center of chars is not supported" << endl;
+                vertical_origin_warned = true;
+            }
+            ddx = ax * cur_font_size;
+            ddy = ay * cur_font_size + cur_letter_space;
+            advance = -ddy;
+        }
+        else
+        {
+            if(!(equal(ox, 0) && equal(oy, 0)))
+            {
+                cerr << "TODO: non-zero origins" << endl;
+            }
+            ddx = ax * cur_font_size + cur_letter_space;
+            ddy = ay * cur_font_size;
+            advance = ddx;
         }
-        ddx = ax * cur_font_size + cur_letter_space;
-        ddy = ay * cur_font_size;
         tracer.draw_char(state, dx, dy, ax, ay);
 
         bool is_space = false;
@@ -103,13 +158,13 @@ void HTMLRenderer::drawString(GfxState * state, GooString * s)
         {
             html_text_page.get_cur_line()->append_padding_char();
             // ignore horiz_scaling, as it has been merged into CTM
-            html_text_page.get_cur_line()->append_offset((ax * cur_font_size + cur_letter_space + cur_word_space) * draw_text_scale);
+            html_text_page.get_cur_line()->append_offset((advance + line_word_space) * draw_text_scale);
         }
         else
         {
             if((param.decompose_ligature) && (uLen > 1) && none_of(u, u+uLen, is_illegal_unicode))
             {
-                html_text_page.get_cur_line()->append_unicodes(u, uLen, ddx);
+                html_text_page.get_cur_line()->append_unicodes(u, uLen, advance);
             }
             else
             {
@@ -122,7 +177,7 @@ void HTMLRenderer::drawString(GfxState * state, GooString * s)
                 {
                     uu = unicode_from_font(code, font);
                 }
-                html_text_page.get_cur_line()->append_unicodes(&uu, 1, ddx);
+                html_text_page.get_cur_line()->append_unicodes(&uu, 1, advance);
                 /*
                  * In PDF, word_space is appended if (n == 1 and *p = ' ')
                  * but in HTML, word_space is appended if (uu == ' ')
@@ -130,20 +185,34 @@ void HTMLRenderer::drawString(GfxState * state, GooString * s)
                 int space_count = (is_space ? 1 : 0) - ((uu == ' ') ? 1 : 0);
                 if(space_count != 0)
                 {
-                    html_text_page.get_cur_line()->append_offset(cur_word_space * draw_text_scale * space_count);
+                    html_text_page.get_cur_line()->append_offset(line_word_space * draw_text_scale * space_count);
                 }
             }
         }
 
-        dx += ddx * cur_horiz_scaling;
-        dy += ddy;
-        if (is_space)
-            dx += cur_word_space * cur_horiz_scaling;
+        if(vertical)
+        {
+            // horiz_scaling does not apply in writing mode
+            dx += ddx;
+            dy += ddy;
+            if (is_space)
+                dy += cur_word_space;
+        }
+        else
+        {
+            dx += ddx * cur_horiz_scaling;
+            dy += ddy;
+            if (is_space)
+                dx += cur_word_space * cur_horiz_scaling;
+        }
 
         p += n;
         len -= n;
     }
 
+    if((param.thumbnail_width > 0) && param.thumbnail_text && ((state->getRender() & 3) != 3))
+        add_thumbnail_text(state, dx, dy);
+
     cur_tx += dx;
     cur_ty += dy;
         
@@ -151,6 +220,45 @@ void HTMLRenderer::drawString(GfxState * state, GooString * s)
     draw_ty += dy;
 }
 
+void HTMLRenderer::add_thumbnail_text(GfxState * state, double dx, double dy)
+{
+    // roughly from the descent to the ascent
+    double font_size = state->getFontSize();
+    double rise = state->getRise();
+    double corners[] = {
+        0, rise - 0.2 * font_size,
+        0, rise + 0.8 * font_size,
+        dx, dy + rise - 0.2 * font_size,
+        dx, dy + rise + 0.8 * font_size,
+    };
+
+    ThumbnailText text;
+    for(int i = 0; i < 4; ++i)
+    {
+        // text space -> user space -> device space
+        double ux, uy, x, y;
+        state->textTransformDelta(corners[i * 2], corners[i * 2 + 1], &ux, &uy);
+        state->transform(state->getCurX() + ux, state->getCurY() + uy, &x, &y);
+        if(i == 0)
+        {
+            text.bbox[0] = text.bbox[2] = x;
+            text.bbox[1] = text.bbox[3] = y;
+        }
+        else
+        {
+            text.bbox[0] = min(text.bbox[0], x);
+            text.bbox[1] = min(text.bbox[1], y);
+            text.bbox[2] = max(text.bbox[2], x);
+            text.bbox[3] = max(text.bbox[3], y);
+        }
+    }
+
+    GfxRGB rgb;
+    state->getFillRGB(&rgb);
+    text.color = (colToByte(rgb.r) << 16) | (colToByte(rgb.g) << 8) | colToByte(rgb.b);
+    thumbnail_texts.push_back(text);
+}
+
 bool HTMLRenderer::is_char_covered(int index)
 {
     auto covered = covered_text_detector.get_chars_covered();
@@ -6,6 +6,7 @@
 #define HTMLSTATE_H__
 
 #include <functional>
+#include <string>
 
 #include "Color.h"
 
@@ -19,6 +20,10 @@ struct FontInfo
     double space_width;
     double ascent, descent;
     bool is_type3;
+    // text in this font is shown in vertical lines
+    bool is_vertical;
+    // the name in PDF
+    std::string name;
     /*
      * As Type 3 fonts have a font matrix
      * a glyph of 1pt can be very large or very small
@@ -64,12 +69,14 @@ struct HTMLLineState
 {
     double x,y;
     double transform_matrix[4];
+    // whether the text flows from top to bottom, (x,y) is then the top center of the first char
+    bool vertical;
     // The page-cope char index(in drawing order) of the first char in this line.
     int first_char_index;
     // A function to determine whether a char is covered at a given index.
     std::function<bool(int)> is_char_covered;
 
-    HTMLLineState(): first_char_index(-1) { }
+    HTMLLineState(): vertical(false), first_char_index(-1) { }
 };
 
 struct HTMLClipState
@@ -153,6 +153,26 @@ void HTMLTextLine::dump_text(ostream & out)
     }
 
     // Start Output
+    if(line_state.vertical)
+    {
+        /*
+         * open <div> for the current vertical text line
+         * (x,y) is the top center of the column, whose width is the largest line-height
+         * the <div> has a zero height, and the text overflows downwards
+         */
+        double column_width = 0;
+        for(auto & s : states)
+            column_width = max(column_width, s.em_size());
+
+        out << "<div class=\"" << CSS::LINE_CN << " " << CSS::VERTICAL_LINE_CN
+            << " " << CSS::TRANSFORM_MATRIX_CN << all_manager.transform_matrix.install(line_state.transform_matrix)
+            << " " << CSS::LEFT_CN             << all_manager.left.install(line_state.x - clip_x1 - column_width / 2)
+            << " " << CSS::HEIGHT_CN           << all_manager.height.install(0)
+            << " " << CSS::BOTTOM_CN           << all_manager.bottom.install(line_state.y - clip_y1)
+            ;
+        // it will be closed by the first state
+    }
+    else
     {
         // open <div> for the current text line
         out << "<div class=\"" << CSS::LINE_CN
@@ -244,7 +264,8 @@ void HTMLTextLine::dump_text(ostream & out)
                 {
                     bool done = false;
                     // check if the offset is equivalent to a single ' '
-                    if(!(state_iter1->hash_umask & State::umask_by_id(State::WORD_SPACE_ID)))
+                    // not for vertical lines, as the vertical advance of ' ' is unknown
+                    if(!line_state.vertical && !(state_iter1->hash_umask & State::umask_by_id(State::WORD_SPACE_ID)))
                     {
                         double space_off = state_iter1->single_space_offset();
                         if(std::abs(target - space_off) <= param.h_eps)
@@ -259,7 +280,10 @@ void HTMLTextLine::dump_text(ostream & out)
                     // finally, just dump it
                     if(!done)
                     {
-                        long long wid = all_manager.whitespace.install(target, &actual_offset);
+                        long long wid = line_state.vertical
+                            ? all_manager.vertical_whitespace.install(target, &actual_offset)
+                            : all_manager.whitespace.install(target, &actual_offset);
+                        const char * whitespace_cn = line_state.vertical ? CSS::VERTICAL_WHITESPACE_CN : CSS::WHITESPACE_CN;
 
                         if(!equal(actual_offset, 0))
                         {
@@ -269,7 +293,7 @@ void HTMLTextLine::dump_text(ostream & out)
                             double threshold = state_iter1->em_size() * (param.space_threshold);
 
                             out << "<span class=\"" << CSS::WHITESPACE_CN
-                                << ' ' << CSS::WHITESPACE_CN << wid << "\">" << (target > (threshold - EPS) ? " " : "") << "</span>";
+                                << ' ' << whitespace_cn << wid << "\">" << (target > (threshold - EPS) ? " " : "") << "</span>";
                         }
                     }
                 }
@@ -300,6 +324,106 @@ void HTMLTextLine::dump_text(ostream & out)
     out << "</div>";
 }
 
+bool HTMLTextLine::get_plain_text(vector<Unicode> & out) const
+{
+    // the same checks as dump_text()
+    if(text.empty() || states.empty() || (states[0].start_idx != 0))
+        return false;
+
+    auto state_iter = states.begin();
+    auto offset_iter = offsets.begin();
+    for(size_t i = 0; i <= text.size(); ++i)
+    {
+        while(((state_iter + 1) != states.end()) && ((state_iter + 1)->start_idx <= i))
+            ++state_iter;
+
+        for(; (offset_iter != offsets.end()) && (offset_iter->start_idx <= i); ++offset_iter)
+        {
+            if(offset_iter->width > state_iter->em_size() * (param.space_threshold) - EPS)
+                out.push_back(' ');
+        }
+
+        if(i == text.size())
+            break;
+
+        int c = text[i];
+        if(c > 0)
+        {
+            out.push_back(c);
+        }
+        else if(c < 0)
+        {
+            const auto & dt = decomposed_text[- c - 1];
+            out.insert(out.end(), dt.begin(), dt.end());
+        }
+    }
+    return true;
+}
+
+void HTMLTextLine::dump_json(ostream & out, int page_no) const
+{
+    vector<Unicode> plain_text;
+    if(!get_plain_text(plain_text))
+        return;
+
+    // the box of the line in its own coordinates, see dump_text()
+    double x1, y1, x2, y2;
+    if(line_state.vertical)
+    {
+        double column_width = 0;
+        for(auto & s : states)
+            column_width = max(column_width, s.em_size());
+        x1 = -column_width / 2;
+        x2 = column_width / 2;
+        y1 = -width;
+        y2 = 0;
+    }
+    else
+    {
+        x1 = 0;
+        x2 = width;
+        y1 = descent;
+        y2 = ascent;
+    }
+
+    // transform the corners into the page
+    const double * tm = line_state.transform_matrix;
+    double bbox[4] = { 0, 0, 0, 0 };
+    for(int i = 0; i < 4; ++i)
+    {
+        double x = (i & 1) ? x2 : x1;
+        double y = (i & 2) ? y2 : y1;
+        double px = line_state.x + tm[0] * x + tm[2] * y;
+        double py = line_state.y + tm[1] * x + tm[3] * y;
+        if((i == 0) || (px < bbox[0])) bbox[0] = px;
+        if((i == 0) || (py < bbox[1])) bbox[1] = py;
+        if((i == 0) || (px > bbox[2])) bbox[2] = px;
+        if((i == 0) || (py > bbox[3])) bbox[3] = py;
+    }
+
+    // the state used by the most chars
+    const State * main_state = &states.front();
+    size_t max_len = 0;
+    for(auto iter = states.begin(); iter != states.end(); ++iter)
+    {
+        size_t end_idx = ((iter + 1) == states.end()) ? text.size() : (iter + 1)->start_idx;
+        if(end_idx - iter->start_idx > max_len)
+        {
+            max_len = end_idx - iter->start_idx;
+            main_state = &*iter;
+        }
+    }
+
+    out << "{\"page\":" << page_no
+        << ",\"bbox\":[" << bbox[0] << "," << bbox[1] << "," << bbox[2] << "," << bbox[3] << "]"
+        << ",\"font\":\"";
+    writeJSON(out, main_state->font_info->name);
+    out << "\",\"size\":" << main_state->font_size
+        << ",\"text\":\"";
+    writeUnicodesJSON(out, plain_text.data(), plain_text.size());
+    out << "\"}\n";
+}
+
 void HTMLTextLine::clear(void)
 {
     states.clear();
@@ -498,7 +622,8 @@ void HTMLTextLine::optimize_normal(std::vector<HTMLTextLine*> & lines)
             // note that we may only change word space, no offset will be affected
             // The actual effect will emerge during flushing, where it could be detected that an offset can be optimized as a single space character
             
-            if(offset_count > 0)
+            // the vertical advance of ' ' is unknown, so offsets in vertical lines are never converted to spaces
+            if((offset_count > 0) && !line_state.vertical)
             {
                 double threshold = (state_iter1->em_size()) * (param.space_threshold);
                 // set word_space for the most frequently used offset
@@ -523,7 +648,7 @@ void HTMLTextLine::optimize_normal(std::vector<HTMLTextLine*> & lines)
                 state_iter1->ids[State::WORD_SPACE_ID] = ws_manager.install(new_word_space, &(state_iter1->word_space)); // install new word_space
                 state_iter1->hash_umask &= (~word_space_umask); // mark that the word_space is not free
             }
-            else // there is no offset at all
+            else // there is no offset at all, or no offset would become a space
             {
                 state_iter1->hash_umask |= word_space_umask; // we just free word_space
             }
@@ -86,6 +86,16 @@ public:
     void append_offset(double width);
     void append_state(const HTMLTextState & text_state);
     void dump_text(std::ostream & out);
+    /**
+     * Append the text of this line to 'out', with offsets wider than space_threshold as ' '.
+     * Return false if the line is not dumped by dump_text().
+     */
+    bool get_plain_text(std::vector<Unicode> & out) const;
+    /**
+     * Write the line as a JSON object in a single line, for --text-json.
+     * Should be called after prepare().
+     */
+    void dump_json(std::ostream & out, int page_no) const;
 
     bool text_empty(void) const { return text.empty(); }
     void clear(void);
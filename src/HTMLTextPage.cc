@@ -27,7 +27,8 @@ HTMLTextPage::~HTMLTextPage()
         delete p;
 }
 
-void HTMLTextPage::dump_text(ostream & out)
+// optimize and prepare all text lines before output
+void HTMLTextPage::prepare_lines(void)
 {
     if(param.optimize_text)
     {
@@ -41,6 +42,11 @@ void HTMLTextPage::dump_text(ostream & out)
         p->prepare();
     if(param.optimize_text)
         optimize();
+}
+
+void HTMLTextPage::dump_text(ostream & out)
+{
+    prepare_lines();
 
     HTMLClipState page_box;
     page_box.xmin = page_box.ymin = 0;
@@ -94,6 +100,24 @@ void HTMLTextPage::dump_text(ostream & out)
     }
 }
 
+void HTMLTextPage::get_plain_text(std::vector<std::vector<Unicode>> & lines) const
+{
+    std::vector<Unicode> line;
+    for(auto p : text_lines)
+    {
+        line.clear();
+        if(p->get_plain_text(line))
+            lines.push_back(line);
+    }
+}
+
+void HTMLTextPage::dump_json(ostream & out, int page_no)
+{
+    prepare_lines();
+    for(auto p : text_lines)
+        p->dump_json(out, page_no);
+}
+
 void HTMLTextPage::dump_css(ostream & out)
 {
     //TODO
@@ -31,6 +31,15 @@ public:
 
     void dump_text(std::ostream & out);
     void dump_css(std::ostream & out);
+    /*
+     * Append the text of each line written by dump_text(), in the same order
+     * Should be called after dump_text()
+     */
+    void get_plain_text(std::vector<std::vector<Unicode>> & lines) const;
+    /*
+     * Write the lines as JSON lines instead of dump_text(), for --text-json
+     */
+    void dump_json(std::ostream & out, int page_no);
     void clear(void);
 
     void open_new_line(const HTMLLineState & line_state);
@@ -43,6 +52,7 @@ public:
     double get_height() { return page_height; }
 
 private:
+    void prepare_lines(void);
     void optimize(void);
 
     const Param & param;
@@ -31,18 +31,21 @@ struct Param
     int embed_javascript;
     int embed_outline;
     int split_pages;
+    int page_bundle_size;
     std::string dest_dir;
     std::string css_filename;
     std::string page_filename;
     std::string outline_filename;
     int process_nontext;
     int process_outline;
+    int outline_chunk_depth;
     int process_annotation;
     int process_form;
     int correct_text_visibility;
     int printing;
     int fallback;
     int tmp_file_size_limit;
+    std::string text_json;
 
     // fonts
     int embed_external_font;
@@ -54,6 +57,7 @@ struct Param
     int squeeze_wide_glyph;
     int override_fstype;
     int process_type3;
+    int process_vertical_text;
 
     // text
     double h_eps, v_eps;
@@ -65,8 +69,35 @@ struct Param
 
     // background image
     std::string bg_format;
+    int bg_quality;
+    int bg_lossless;
+    int bg_effort;
     int svg_node_count_limit;
     int svg_embed_bitmap;
+    std::string svg_bitmap_format;
+    std::string svg_embed_mode;
+    int svg_minify;
+    int svg_precision;
+    int svgz;
+    int bg_passthrough;
+    int extract_image;
+    int css_draw;
+    int dedup_image;
+    int bg_shared_forms;
+    int bg_tile_size;
+    int bg_solid_min_size;
+    std::string bg_srcset;
+    int bg_quantize;
+    int bg_gray_render;
+
+    // thumbnails
+    int thumbnail_width;
+    int thumbnail_text;
+    std::string thumbnail_index_filename;
+
+    // search
+    int search_index;
+    std::string search_index_filename;
 
     // encryption
     std::string owner_password, user_password;
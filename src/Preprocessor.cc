@@ -2,6 +2,7 @@
  * Preprocessor.cc
  *
  * Check used codes for each font
+ * Find forms drawn on multiple pages
  *
  * by WangLu
  * 2012.09.07
@@ -10,13 +11,18 @@
 #include <cstring>
 #include <iostream>
 #include <algorithm>
+#include <cmath>
 
 #include <GfxState.h>
 #include <GfxFont.h>
+#include <Lexer.h>
+#include <Parser.h>
 
 #include "Preprocessor.h"
 #include "util/misc.h"
 #include "util/const.h"
+#include "util/math.h"
+#include "util/image.h"
 
 namespace pdf2htmlEX {
 
@@ -24,6 +30,11 @@ using std::cerr;
 using std::endl;
 using std::flush;
 using std::max;
+using std::all_of;
+using std::any_of;
+using std::find;
+using std::string;
+using std::vector;
 
 Preprocessor::Preprocessor(const Param & param)
     : OutputDev()
@@ -53,6 +64,9 @@ void Preprocessor::process(PDFDoc * doc)
                 true,  // crop
                 false, // printing
                 nullptr, nullptr, nullptr, nullptr);
+
+        if(param.bg_shared_forms)
+            scan_forms(doc, i);
     }
     if(page_count >= 0)
         cerr << "Preprocessing: " << page_count << "/" << page_count;
@@ -98,6 +112,204 @@ void Preprocessor::startPage(int pageNum, GfxState *state, XRef * xref)
     max_height = max<double>(max_height, state->getPageHeight());
 }
 
+/*
+ * Parse the content stream of a page, and record the CTM for each form XObject drawn by 'Do'.
+ * Forms inside other forms are ignored.
+ */
+void Preprocessor::scan_forms(PDFDoc * doc, int pageno)
+{
+    Page * page = doc->getPage(pageno);
+    Dict * resources = page->getResourceDict();
+    if(!resources)
+        return;
+
+    Object xobjects;
+    resources->lookup("XObject", &xobjects);
+    if(!xobjects.isDict())
+    {
+        xobjects.free();
+        return;
+    }
+
+    Object contents;
+    page->getContents(&contents);
+    if(!(contents.isStream() || contents.isArray()))
+    {
+        contents.free();
+        xobjects.free();
+        return;
+    }
+
+    XRef * xref = doc->getXRef();
+    Parser * parser = new Parser(xref, new Lexer(xref, &contents), gFalse);
+
+    double ctm[6] = { 1, 0, 0, 1, 0, 0 };
+    vector<double> ctm_stack;
+    vector<Object> args;
+    auto & keys = page_forms[pageno];
+
+    Object obj;
+    parser->getObj(&obj);
+    while(!obj.isEOF())
+    {
+        if(!obj.isCmd())
+        {
+            // same as the limit in Gfx
+            if(args.size() >= 33)
+            {
+                args.front().free();
+                args.erase(args.begin());
+            }
+            args.push_back(obj);
+            parser->getObj(&obj);
+            continue;
+        }
+
+        const char * cmd = obj.getCmd();
+        if(!strcmp(cmd, "q"))
+        {
+            ctm_stack.insert(ctm_stack.end(), ctm, ctm + 6);
+        }
+        else if(!strcmp(cmd, "Q"))
+        {
+            if(!ctm_stack.empty())
+            {
+                memcpy(ctm, &ctm_stack[ctm_stack.size() - 6], sizeof(ctm));
+                ctm_stack.resize(ctm_stack.size() - 6);
+            }
+        }
+        else if(!strcmp(cmd, "cm"))
+        {
+            if((args.size() == 6) && all_of(args.begin(), args.end(), [](Object & o) { return o.isNum(); }))
+            {
+                double m[6];
+                for(int i = 0; i < 6; ++i)
+                    m[i] = args[i].getNum();
+                double old_ctm[6];
+                memcpy(old_ctm, ctm, sizeof(ctm));
+                tm_multiply(ctm, old_ctm, m);
+            }
+        }
+        else if(!strcmp(cmd, "Do"))
+        {
+            if((args.size() == 1) && args[0].isName())
+            {
+                Object ref, xobj, subtype;
+                xobjects.dictLookupNF(args[0].getName(), &ref);
+                if(ref.isRef()
+                   && xobjects.dictLookup(args[0].getName(), &xobj)->isStream()
+                   && xobj.streamGetDict()->lookup("Subtype", &subtype)->isName("Form")
+                   && is_shareable_form(xobj.streamGetDict()))
+                {
+                    string key = get_form_key(page, ref.getRef(), ctm);
+                    if(find(keys.begin(), keys.end(), key) == keys.end())
+                    {
+                        keys.push_back(key);
+                        ++ form_page_counts[key];
+                    }
+                }
+                subtype.free();
+                xobj.free();
+                ref.free();
+            }
+        }
+        else if(!strcmp(cmd, "ID"))
+        {
+            // skip the data of an inline image, as Gfx does
+            Stream * str = parser->getStream();
+            if(str)
+            {
+                int c1 = str->getChar();
+                int c2 = str->getChar();
+                while(!((c1 == 'E') && (c2 == 'I')) && (c2 != EOF))
+                {
+                    c1 = c2;
+                    c2 = str->getChar();
+                }
+            }
+        }
+
+        for(auto & o : args)
+            o.free();
+        args.clear();
+
+        obj.free();
+        parser->getObj(&obj);
+    }
+    obj.free();
+
+    for(auto & o : args)
+        o.free();
+
+    delete parser;
+    contents.free();
+    xobjects.free();
+}
+
+string Preprocessor::get_form_key (Page * page, const Ref & ref, const double * matrix) const
+{
+    // the same form looks the same only on pages of the same size
+    PDFRectangle * box = param.use_cropbox ? page->getCropBox() : page->getMediaBox();
+    string key = get_xobject_key(ref, matrix);
+    for(double v : { box->x1, box->y1, box->x2, box->y2 })
+        key += " " + std::to_string(std::llround(v * 100));
+    key += " " + std::to_string(page->getRotate());
+    return key;
+}
+
+bool Preprocessor::is_shareable_form (Dict * dict)
+{
+    // the visibility of optional content, and the blending of groups and soft masks
+    // depend on what is drawn around the form, which is not in the layer
+    Object obj;
+    bool shareable = dict->lookupNF("OC", &obj)->isNull();
+    obj.free();
+    if(shareable)
+    {
+        shareable = dict->lookupNF("Group", &obj)->isNull();
+        obj.free();
+    }
+    if(shareable)
+    {
+        shareable = dict->lookupNF("SMask", &obj)->isNull();
+        obj.free();
+    }
+    if(!shareable)
+        return false;
+
+    // soft masks set by the graphics states used inside the form
+    Object resources, ext_gstates;
+    if(dict->lookup("Resources", &resources)->isDict()
+       && resources.dictLookup("ExtGState", &ext_gstates)->isDict())
+    {
+        for(int i = 0; shareable && (i < ext_gstates.dictGetLength()); ++i)
+        {
+            Object gstate, smask;
+            if(ext_gstates.dictGetVal(i, &gstate)->isDict())
+                shareable = !gstate.dictLookup("SMask", &smask)->isDict();
+            smask.free();
+            gstate.free();
+        }
+    }
+    ext_gstates.free();
+    resources.free();
+    return shareable;
+}
+
+bool Preprocessor::is_shared_form (const string & key) const
+{
+    auto iter = form_page_counts.find(key);
+    return (iter != form_page_counts.end()) && (iter->second > 1);
+}
+
+bool Preprocessor::has_shared_forms (int pageno) const
+{
+    auto iter = page_forms.find(pageno);
+    if(iter == page_forms.end())
+        return false;
+    return any_of(iter->second.begin(), iter->second.end(), [this](const string & key) { return is_shared_form(key); });
+}
+
 const char * Preprocessor::get_code_map (long long font_id) const
 {
     auto iter = code_maps.find(font_id);
@@ -5,6 +5,7 @@
  *
  * Check used codes for each font
  * Collect all used link destinations
+ * Find forms drawn on multiple pages
  *
  * by WangLu
  * 2012.09.07
@@ -15,10 +16,13 @@
 #define PREPROCESSOR_H__
 
 #include <unordered_map>
+#include <string>
+#include <vector>
 
 #include <OutputDev.h>
 #include <PDFDoc.h>
 #include <Annot.h>
+#include <Page.h>
 #include "Param.h"
 
 namespace pdf2htmlEX {
@@ -50,7 +54,21 @@ public:
     double get_max_width (void) const { return max_width; }
     double get_max_height (void) const { return max_height; }
 
+    // for --bg-shared-forms
+    // identify a form drawn on a page
+    // matrix: the form space -> page space (in pt) matrix
+    std::string get_form_key (Page * page, const Ref & ref, const double * matrix) const;
+    // whether the form is drawn on more than one page
+    bool is_shared_form (const std::string & key) const;
+    bool has_shared_forms (int pageno) const;
+    // whether a form could be rendered alone into a transparent layer
+    // forms with optional content, transparency groups or soft masks are not
+    static bool is_shareable_form (Dict * dict);
+
 protected:
+    // find forms drawn directly by the content stream of a page
+    void scan_forms(PDFDoc * doc, int pageno);
+
     const Param & param;
 
     double max_width, max_height;
@@ -59,6 +77,11 @@ protected:
     char * cur_code_map;
 
     std::unordered_map<long long, char*> code_maps;
+
+    // map<key of the form, number of pages using it>
+    std::unordered_map<std::string, int> form_page_counts;
+    // map<page number, keys of the forms on the page>
+    std::unordered_map<int, std::vector<std::string>> page_forms;
 };
 
 } // namespace pdf2htmlEX
@@ -0,0 +1,148 @@
+/*
+ * SearchIndex.cc
+ *
+ * Index the words in the text for searching
+ */
+
+#include "SearchIndex.h"
+
+#include "util/encoding.h"
+
+namespace pdf2htmlEX {
+
+using std::ostream;
+using std::vector;
+using std::make_pair;
+
+void SearchIndex::add_line(int page_no, int line_no, const vector<Unicode> & text)
+{
+    vector<Unicode> word;
+    for(auto u : text)
+    {
+        if(is_separator(u) || is_ideograph(u))
+        {
+            if(!word.empty())
+            {
+                add_word(word, page_no, line_no);
+                word.clear();
+            }
+            if(is_ideograph(u))
+                add_word(vector<Unicode>(1, u), page_no, line_no);
+        }
+        else
+        {
+            word.push_back(fold_case(u));
+        }
+    }
+    if(!word.empty())
+        add_word(word, page_no, line_no);
+}
+
+void SearchIndex::add_word(const vector<Unicode> & word, int page_no, int line_no)
+{
+    auto & lines = postings[word];
+    // pages and lines are added in order
+    if(lines.empty() || (lines.back() != make_pair(page_no, line_no)))
+        lines.emplace_back(page_no, line_no);
+}
+
+void SearchIndex::dump(ostream & out) const
+{
+    out << "{\"terms\":[";
+    {
+        const vector<Unicode> * prev_term = nullptr;
+        for(auto & p : postings)
+        {
+            const auto & term = p.first;
+            size_t prefix_len = 0;
+            int prefix_units = 0;
+            if(prev_term)
+            {
+                out << ",";
+                while((prefix_len < term.size()) && (prefix_len < prev_term->size())
+                        && (term[prefix_len] == (*prev_term)[prefix_len]))
+                {
+                    // characters outside BMP are surrogate pairs in JavaScript
+                    prefix_units += (term[prefix_len] >= 0x10000) ? 2 : 1;
+                    ++prefix_len;
+                }
+            }
+            out << prefix_units << ",\"";
+            writeUnicodesJSON(out, term.data() + prefix_len, term.size() - prefix_len);
+            out << "\"";
+            prev_term = &term;
+        }
+    }
+    out << "],\"postings\":[";
+    {
+        bool first_term = true;
+        for(auto & p : postings)
+        {
+            if(!first_term)
+                out << ",";
+            first_term = false;
+
+            out << "[";
+            int prev_page_no = 0, prev_line_no = 0;
+            bool first_line = true;
+            for(auto & line : p.second)
+            {
+                if(!first_line)
+                    out << ",";
+                first_line = false;
+
+                out << (line.first - prev_page_no) << ","
+                    << ((line.first == prev_page_no) ? (line.second - prev_line_no) : line.second);
+                prev_page_no = line.first;
+                prev_line_no = line.second;
+            }
+            out << "]";
+        }
+    }
+    out << "]}";
+}
+
+bool SearchIndex::is_separator(Unicode u)
+{
+    if(u < 0x80)
+    {
+        return !(((u >= '0') && (u <= '9'))
+                || ((u >= 'A') && (u <= 'Z'))
+                || ((u >= 'a') && (u <= 'z')));
+    }
+
+    return ((u >= 0xa0) && (u <= 0xbf)) // Latin-1 punctuation and symbols
+        || (u == 0xd7) || (u == 0xf7)
+        || ((u >= 0x2000) && (u <= 0x206f)) // General Punctuation
+        || ((u >= 0x3000) && (u <= 0x303f)) // CJK Symbols and Punctuation
+        || ((u >= 0xfe30) && (u <= 0xfe4f)) // CJK Compatibility Forms
+        || ((u >= 0xff00) && (u <= 0xff0f)) // Fullwidth ASCII punctuation
+        || ((u >= 0xff1a) && (u <= 0xff20))
+        || ((u >= 0xff3b) && (u <= 0xff40))
+        || ((u >= 0xff5b) && (u <= 0xff65))
+        || (u == 0xfffd);
+}
+
+bool SearchIndex::is_ideograph(Unicode u)
+{
+    return ((u >= 0x3040) && (u <= 0x30ff)) // Hiragana and Katakana
+        || ((u >= 0x3400) && (u <= 0x4dbf)) // CJK Unified Ideographs Extension A
+        || ((u >= 0x4e00) && (u <= 0x9fff)) // CJK Unified Ideographs
+        || ((u >= 0xac00) && (u <= 0xd7af)) // Hangul Syllables
+        || ((u >= 0xf900) && (u <= 0xfaff)) // CJK Compatibility Ideographs
+        || ((u >= 0x20000) && (u <= 0x2ffff));
+}
+
+Unicode SearchIndex::fold_case(Unicode u)
+{
+    if(((u >= 'A') && (u <= 'Z'))
+            || ((u >= 0xc0) && (u <= 0xde) && (u != 0xd7)) // Latin-1
+            || ((u >= 0x391) && (u <= 0x3a9)) // Greek
+            || ((u >= 0x410) && (u <= 0x42f))) // Cyrillic
+        return u + 0x20;
+    if((u >= 0x400) && (u <= 0x40f))
+        return u + 0x50;
+    return u;
+}
+
+} //namespace pdf2htmlEX
@@ -0,0 +1,58 @@
+/*
+ * Header file for SearchIndex
+ */
+
+#ifndef SEARCHINDEX_H__
+#define SEARCHINDEX_H__
+
+#include <ostream>
+#include <vector>
+#include <map>
+#include <utility>
+
+#include <CharTypes.h>
+
+namespace pdf2htmlEX {
+
+/*
+ * Collect the words in text lines, and write them as a JSON index
+ * to be searched by pdf2htmlEX.js without loading the pages
+ *
+ * Words are case folded, and each ideograph is a word by itself
+ * The same rules are used by pdf2htmlEX.js for queries, keep them in sync
+ */
+class SearchIndex
+{
+public:
+    /*
+     * line_no: index of the line in the page, in the order of output
+     */
+    void add_line(int page_no, int line_no, const std::vector<Unicode> & text);
+
+    /*
+     * {"terms":[...],"postings":[...]}
+     *
+     * terms are sorted by code points and front coded,
+     * i.e. each term is written as the length of the prefix shared with the previous one (in UTF-16 code units),
+     * followed by the rest of the term
+     *
+     * postings[i] lists the lines containing terms[i], as pairs of numbers, which are
+     * - the page number, as the difference from the previous pair
+     * - the line number, as the difference from the previous pair if in the same page
+     */
+    void dump(std::ostream & out) const;
+
+    bool empty(void) const { return postings.empty(); }
+
+    static bool is_separator(Unicode u);
+    static bool is_ideograph(Unicode u);
+    static Unicode fold_case(Unicode u);
+
+private:
+    void add_word(const std::vector<Unicode> & word, int page_no, int line_no);
+
+    std::map<std::vector<Unicode>, std::vector<std::pair<int, int>>> postings;
+};
+
+} //namespace pdf2htmlEX
+#endif //SEARCHINDEX_H__
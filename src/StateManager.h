@@ -12,6 +12,7 @@
 #include <iostream>
 #include <map>
 #include <unordered_map>
+#include <string>
 
 #include "Color.h"
 
@@ -258,6 +259,26 @@ public:
     }
 };
 
+// text shift in vertical lines
+class VerticalWhitespaceManager : public StateManager<double, VerticalWhitespaceManager>
+{
+public:
+    static const char * get_css_class_name (void) { return CSS::VERTICAL_WHITESPACE_CN; }
+    double default_value(void) { return 0; }
+    void dump_value(std::ostream & out, double value) { 
+        out << ((value > 0) ? "height:"
+                            : "margin-top:")
+            << round(value) << "px;";
+    }
+    void dump_print_value(std::ostream & out, double value, double scale) 
+    {
+        value *= scale;
+        out << ((value > 0) ? "height:"
+                            : "margin-top:")
+            << round(value) << "pt;";
+    }
+};
+
 class WidthManager : public StateManager<double, WidthManager>
 {
 public:
@@ -408,6 +429,39 @@ private:
     std::unordered_map<int, std::pair<double,double>> value_map; 
 };
 
+/*
+ * Manage the CSS backgrounds of shapes, e.g. colors and gradients
+ *
+ * They are used as they are, without merging similar values
+ */
+class ShapeBackgroundManager
+{
+public:
+    long long install(const std::string & new_value) {
+        auto iter = value_map.find(new_value);
+        if(iter != value_map.end())
+        {
+            return iter->second;
+        }
+
+        long long id = value_map.size();
+        value_map.insert(std::make_pair(new_value, id));
+        return id;
+    }
+
+    void dump_css(std::ostream & out) {
+        for(auto & p : value_map)
+        {
+            out << "." << CSS::SHAPE_BACKGROUND_CN << p.second << "{background:" << p.first << ";}" << std::endl;
+        }
+    }
+
+    void dump_print_css(std::ostream & out, double scale) {}
+
+private:
+    std::unordered_map<std::string, long long> value_map;
+};
+
 struct AllStateManager
 {
     TransformMatrixManager transform_matrix;
@@ -415,6 +469,7 @@ struct AllStateManager
     StrokeColorManager         stroke_color;
     LetterSpaceManager         letter_space;
     WhitespaceManager            whitespace;
+    VerticalWhitespaceManager    vertical_whitespace;
     WordSpaceManager             word_space;
     FillColorManager             fill_color;
     FontSizeManager               font_size;
@@ -423,6 +478,7 @@ struct AllStateManager
     WidthManager                      width;
     LeftManager                        left;
     BGImageSizeManager         bgimage_size;
+    ShapeBackgroundManager shape_background;
 };
 
 } // namespace pdf2htmlEX 
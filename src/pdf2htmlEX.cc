@@ -29,6 +29,18 @@
 #include <cairo.h>
 #endif
 
+#if ENABLE_PALETTE_PNG
+#include <png.h>
+#endif
+
+#if ENABLE_WEBP
+#include <webp/encode.h>
+#endif
+
+#if ENABLE_AVIF
+#include <avif/avif.h>
+#endif
+
 #include "ArgParser.h"
 #include "Param.h"
 #include "HTMLRenderer/HTMLRenderer.h"
@@ -62,6 +74,18 @@ void show_version_and_exit(const char * dummy = nullptr)
     cerr << "  libfontforge " << ffw_get_version() << endl;
 #if ENABLE_SVG
     cerr << "  cairo " << cairo_version_string() << endl;
+#endif
+#if ENABLE_PALETTE_PNG
+    cerr << "  libpng " << PNG_LIBPNG_VER_STRING << endl;
+#endif
+#if ENABLE_WEBP
+    {
+        int v = WebPGetEncoderVersion();
+        cerr << "  libwebp " << (v >> 16) << "." << ((v >> 8) & 0xff) << "." << (v & 0xff) << endl;
+    }
+#endif
+#if ENABLE_AVIF
+    cerr << "  libavif " << avifVersion() << endl;
 #endif
     cerr << "Default data-dir: " << param.data_dir << endl;
     cerr << "Supported image format:";
@@ -73,6 +97,15 @@ void show_version_and_exit(const char * dummy = nullptr)
 #endif
 #if ENABLE_SVG
     cerr << " svg";
+#endif
+#if ENABLE_WEBP
+    cerr << " webp";
+#endif
+#if ENABLE_AVIF
+    cerr << " avif";
+#endif
+#ifdef ENABLE_LIBPNG
+    cerr << " auto";
 #endif
     cerr << endl;
 
@@ -150,17 +183,20 @@ void parse_options (int argc, char **argv)
         .add("embed-javascript", &param.embed_javascript, 1, "embed JavaScript files into output")
         .add("embed-outline", &param.embed_outline, 1, "embed outlines into output")
         .add("split-pages", &param.split_pages, 0, "split pages into separate files")
+        .add("page-bundle-size", &param.page_bundle_size, 0, "if positive, pack this many split pages into each file")
         .add("dest-dir", &param.dest_dir, ".", "specify destination directory")
         .add("css-filename", &param.css_filename, "", "filename of the generated css file")
         .add("page-filename", &param.page_filename, "", "filename template for split pages ")
         .add("outline-filename", &param.outline_filename, "", "filename of the generated outline file")
         .add("process-nontext", &param.process_nontext, 1, "render graphics in addition to text")
         .add("process-outline", &param.process_outline, 1, "show outline in HTML")
+        .add("outline-chunk-depth", &param.outline_chunk_depth, 0, "if positive, write outline as JSON with this many levels per file, loaded on demand")
         .add("process-annotation", &param.process_annotation, 0, "show annotation in HTML")
         .add("process-form", &param.process_form, 0, "include text fields and radio buttons")
         .add("printing", &param.printing, 1, "enable printing support")
         .add("fallback", &param.fallback, 0, "output in fallback mode")
         .add("tmp-file-size-limit", &param.tmp_file_size_limit, -1, "Maximum size (in KB) used by temporary files, -1 for no limit.")
+        .add("text-json", &param.text_json, "", "write text lines as JSON lines into this file (\"-\" for stdout), instead of HTML")
 
         // fonts
         .add("embed-external-font", &param.embed_external_font, 1, "embed local match for external fonts")
@@ -172,6 +208,7 @@ void parse_options (int argc, char **argv)
         .add("squeeze-wide-glyph", &param.squeeze_wide_glyph, 1, "shrink wide glyphs instead of truncating them")
         .add("override-fstype", &param.override_fstype, 0, "clear the fstype bits in TTF/OTF fonts")
         .add("process-type3", &param.process_type3, 0, "convert Type 3 fonts for web (experimental)")
+        .add("process-vertical-text", &param.process_vertical_text, 1, "show text in vertical writing mode as HTML text")
 
         // text
         .add("heps", &param.h_eps, 1.0, "horizontal threshold for merging text, in pixels")
@@ -185,9 +222,36 @@ void parse_options (int argc, char **argv)
 
         // background image
         .add("bg-format", &param.bg_format, "png", "specify background image format")
+        .add("bg-quality", &param.bg_quality, 0, "quality of JPEG, WebP and AVIF background images (1-100); 0 to use the default of the encoder")
+        .add("bg-lossless", &param.bg_lossless, 0, "use lossless compression for WebP and AVIF background images")
+        .add("bg-effort", &param.bg_effort, -1, "compression effort of WebP and AVIF background images, from 0 (fastest) to 10 (smallest); -1 to use the default of the encoder")
         .add("svg-node-count-limit", &param.svg_node_count_limit, -1, "if node count in a svg background image exceeds this limit,"
                 " fall back this page to bitmap background; negative value means no limit.")
         .add("svg-embed-bitmap", &param.svg_embed_bitmap, 1, "1: embed bitmaps in svg background; 0: dump bitmaps to external files if possible.")
+        .add("svg-bitmap-format", &param.svg_bitmap_format, "png", "format of bitmaps dumped from svg background images: png, jpg or webp")
+        .add("svg-minify", &param.svg_minify, 0, "reduce the size of svg background images")
+        .add("svg-precision", &param.svg_precision, 2, "decimal places of coordinates in minified svg background images")
+        .add("svgz", &param.svgz, 0, "write external svg background images gzipped, as .svgz")
+        .add("svg-embed-mode", &param.svg_embed_mode, "base64", "how to embed svg background: base64, utf8 (data URI) or inline (<svg> in the page)")
+        .add("bg-passthrough", &param.bg_passthrough, 0, "use the original image as background for pages whose only graphic is a single image")
+        .add("extract-image", &param.extract_image, 0, "output images as separate elements instead of rendering them in the background")
+        .add("css-draw", &param.css_draw, 0, "draw rectangles and straight lines with CSS instead of rendering them in the background")
+        .add("dedup-image", &param.dedup_image, 0, "output identical images only once")
+        .add("bg-shared-forms", &param.bg_shared_forms, 0, "render forms repeated on multiple pages as shared images, instead of in the background of each page")
+        .add("bg-tile-size", &param.bg_tile_size, 0, "split bitmap background images into tiles of this size (in pixels), and output only non-blank ones; 0 to disable")
+        .add("bg-solid-min-size", &param.bg_solid_min_size, 0, "output single-color rectangles at least this large (in pixels) in bitmap backgrounds as CSS boxes; 0 to disable")
+        .add("bg-srcset", &param.bg_srcset, "", "comma-separated pixel densities of downscaled copies of bitmap background images, e.g. \"1,1.5\", listed in the srcset attribute")
+        .add("bg-quantize", &param.bg_quantize, 0, "reduce PNG background images with many colors to 256 colors (lossy)")
+        .add("bg-gray-render", &param.bg_gray_render, 0, "render the background of pages without colors in grayscale")
+
+        // thumbnails
+        .add("thumbnail-width", &param.thumbnail_width, 0, "width (in pixels) of page thumbnails made from bitmap backgrounds; 0 to disable")
+        .add("thumbnail-text", &param.thumbnail_text, 1, "draw texts in thumbnails as boxes")
+        .add("thumbnail-index-filename", &param.thumbnail_index_filename, "", "filename of the JSON index of thumbnails")
+
+        // search
+        .add("search-index", &param.search_index, 0, "write an index of the words in the text, to be searched by pdf2htmlEX.js")
+        .add("search-index-filename", &param.search_index_filename, "", "filename of the search index")
 
         // encryption
         .add("owner-password,o", &param.owner_password, "", "owner password (for encrypted files)", true)
@@ -309,15 +373,48 @@ void check_param()
         }
     }
 
+    if(param.thumbnail_index_filename.empty())
+    {
+        const string s = get_filename(param.input_filename);
+        if(get_suffix(param.input_filename) == ".pdf")
+        {
+            param.thumbnail_index_filename = s.substr(0, s.size() - 4) + ".thumbnails.json";
+        }
+        else
+        {
+            param.thumbnail_index_filename = s + ".thumbnails.json";
+        }
+    }
+
+    if(param.search_index_filename.empty())
+    {
+        const string s = get_filename(param.input_filename);
+        if(get_suffix(param.input_filename) == ".pdf")
+        {
+            param.search_index_filename = s.substr(0, s.size() - 4) + ".search.json";
+        }
+        else
+        {
+            param.search_index_filename = s + ".search.json";
+        }
+    }
+
     if(false) { }
 #ifdef ENABLE_LIBPNG
     else if (param.bg_format == "png") { }
+    else if (param.bg_format == "auto") { }
 #endif
 #ifdef ENABLE_LIBJPEG
     else if (param.bg_format == "jpg") { }
 #endif
 #if ENABLE_SVG
     else if(param.bg_format == "svg") { }
+#endif
+#if ENABLE_WEBP
+    else if(param.bg_format == "webp") { }
+#endif
+#if ENABLE_AVIF
+    else if(param.bg_format == "avif") { }
 #endif
     else
     {
@@ -338,11 +435,86 @@ void check_param()
         cerr << "Warning: No hint tool is specified for truetype fonts, the result may be rendered poorly in some circumstances." << endl;
     }
 
+#if not ENABLE_SVGZ
+    if (param.svgz)
+    {
+        cerr << "Warning: --svgz is disabled because zlib support is not built in this version of pdf2htmlEX." << endl;
+        param.svgz = 0;
+    }
+#endif
+
+    if ((param.svg_embed_mode != "base64") && (param.svg_embed_mode != "utf8") && (param.svg_embed_mode != "inline"))
+    {
+        cerr << "Unknown svg embed mode: " << param.svg_embed_mode << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    if(false) { }
+    else if (param.svg_bitmap_format == "png") { }
+#ifdef ENABLE_LIBJPEG
+    else if (param.svg_bitmap_format == "jpg") { }
+#endif
+#if ENABLE_WEBP
+    else if (param.svg_bitmap_format == "webp") { }
+#endif
+    else
+    {
+        cerr << "Image format not supported for svg bitmaps: " << param.svg_bitmap_format << endl;
+        exit(EXIT_FAILURE);
+    }
+
     if (param.embed_image && (param.bg_format == "svg") && !param.svg_embed_bitmap)
     {
         cerr << "Warning: --svg-embed-bitmap is forced on because --embed-image is on, or the dumped bitmaps can't be loaded." << endl;
         param.svg_embed_bitmap = 1;
     }
+
+#ifndef ENABLE_LIBPNG
+    if (param.bg_shared_forms)
+    {
+        cerr << "Warning: --bg-shared-forms is disabled because PNG support is not built in this version of pdf2htmlEX." << endl;
+        param.bg_shared_forms = 0;
+    }
+#endif
+
+#if not ENABLE_PALETTE_PNG
+    if (param.bg_quantize)
+    {
+        cerr << "Warning: --bg-quantize is disabled because palette PNG support is not built in this version of pdf2htmlEX." << endl;
+        param.bg_quantize = 0;
+    }
+#endif
+
+    if (!param.bg_srcset.empty() && param.embed_image)
+    {
+        cerr << "Warning: --bg-srcset is ignored because --embed-image is on, or all resolutions would be embedded." << endl;
+        param.bg_srcset.clear();
+    }
+
+    if (param.bg_gray_render && param.proof)
+    {
+        cerr << "Warning: --bg-gray-render is disabled because colors are used by --proof." << endl;
+        param.bg_gray_render = 0;
+    }
+
+    if ((param.page_bundle_size > 0) && (!param.split_pages))
+    {
+        cerr << "Warning: --page-bundle-size is ignored because --split-pages is off." << endl;
+        param.page_bundle_size = 0;
+    }
+
+    // only text is processed for --text-json
+    if (!param.text_json.empty())
+    {
+        param.process_nontext = 0;
+        param.process_outline = 0;
+        param.process_annotation = 0;
+        param.process_form = 0;
+        param.split_pages = 0;
+        param.page_bundle_size = 0;
+        param.thumbnail_width = 0;
+        param.search_index = 0;
+    }
 }
 
 int main(int argc, char **argv)
@@ -42,11 +42,14 @@ const std::map<std::string, EmbedStringEntry> EMBED_STRING_MAP({
 
 const std::map<std::string, std::string> FORMAT_MIME_TYPE_MAP({
     {"eot", "application/vnd.ms-fontobject"},
+    {"avif", "image/avif"},
     {"jpg", "image/jpeg"},
     {"otf", "application/x-font-otf"},
     {"png", "image/png"},
     {"svg", "image/svg+xml"},
+    {"svgz", "image/svg+xml"},
     {"ttf", "application/x-font-ttf"},
+    {"webp", "image/webp"},
     {"woff", "application/font-woff"},
 });
 
@@ -137,18 +137,38 @@ void writeJSON(ostream & out, const string & s)
         {
             case '\\': out << "\\\\"; break;
             case '"': out << "\\\""; break;
-            case '\'': out << "\\\'"; break;
+            case '\'': out << "\\u0027"; break; // "\'" is not valid JSON
             case '/': out << "\\/"; break;
             case '\b': out << "\\b"; break;
             case '\f': out << "\\f"; break;
             case '\n': out << "\\n"; break;
             case '\r': out << "\\r"; break;
             case '\t': out << "\\t"; break;
-            default: out << c; break;
+            default:
+                if((c >= 0) && (c < 0x20))
+                {
+                    static const char * hexchars = "0123456789abcdef";
+                    out << "\\u00" << hexchars[(c>>4)&0xf] << hexchars[c&0xf];
+                }
+                else
+                    out << c;
+                break;
         }
     }
 }
 
+void writeUnicodesJSON(ostream & out, const Unicode * u, int uLen)
+{
+    string s;
+    for(int i = 0; i < uLen; ++i)
+    {
+        char buf[4];
+        auto n = mapUTF8(u[i], buf, 4);
+        s.append(buf, n);
+    }
+    writeJSON(out, s);
+}
+
 void writeAttribute(std::ostream & out, const std::string & s)
 {
     for (auto c : s)
@@ -31,6 +31,11 @@ void writeUnicodes(std::ostream & out, const Unicode * u, int uLen);
  */
 void writeJSON(std::ostream & out, const std::string & s);
 
+/*
+ * Map Unicode to UTF-8, with JSON escaping
+ */
+void writeUnicodesJSON(std::ostream & out, const Unicode * u, int uLen);
+
 /*
  * HTML tag attribute escaping
  */
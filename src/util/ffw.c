@@ -434,6 +434,30 @@ void ffw_set_widths(int * width_list, int mapping_len,
     }
 }
 
+void ffw_set_vertical_widths(int * vwidth_list, int mapping_len)
+{
+    SplineFont * sf = cur_fv->sf;
+    sf->hasvmetrics = 1;
+
+    EncMap * map = cur_fv->map;
+    int i;
+    int imax = min(mapping_len, map->enccount);
+    for(i = 0; i < imax; ++i)
+    {
+        if(vwidth_list[i] == -1)
+            continue;
+
+        int j = map->map[i];
+        if(j == -1) continue;
+
+        SplineChar * sc = sf->glyphs[j];
+        if(sc == NULL)
+            sc = SFMakeChar(cur_fv->sf, cur_fv->map, j);
+
+        sc->vwidth = vwidth_list[i];
+    }
+}
+
 void ffw_import_svg_glyph(int code, const char * filename, double ox, double oy, double width)
 {
     int enc = SFFindSlot(cur_fv->sf, cur_fv->map, code, "");
@@ -59,6 +59,8 @@ void ffw_set_metric(double ascent, double descent);
 
 void ffw_set_widths(int * width_list, int mapping_len, 
         int stretch_narrow, int squeeze_wide);
+// set the vertical advances, and enable vertical metrics of the font
+void ffw_set_vertical_widths(int * vwidth_list, int mapping_len);
 
 ////////////////////////
 // others
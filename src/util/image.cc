@@ -0,0 +1,589 @@
+/*
+ * Functions handling image streams in PDF
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <algorithm>
+
+#include "pdf2htmlEX-config.h"
+
+#if ENABLE_PALETTE_PNG
+#include <png.h>
+#endif
+
+#if ENABLE_WEBP
+#include <webp/encode.h>
+#endif
+
+#if ENABLE_AVIF
+#include <avif/avif.h>
+#endif
+
+#include <poppler-config.h>
+#include <Object.h>
+#include <goo/ImgWriter.h>
+#include <goo/PNGWriter.h>
+
+#include "image.h"
+#include "util/math.h"
+
+namespace pdf2htmlEX {
+
+using std::string;
+using std::vector;
+using std::unique_ptr;
+using std::ofstream;
+using std::ifstream;
+
+string get_image_key(const Ref & ref, const double * ctm, const double * default_ictm)
+{
+    // the image space -> page space (in pt) matrix
+    double m[6];
+    tm_multiply(m, default_ictm, ctm);
+    return get_xobject_key(ref, m);
+}
+
+string get_xobject_key(const Ref & ref, const double * matrix)
+{
+    // in 1/100 pt, such that small errors introduced by different resolutions are ignored
+    string key = std::to_string(ref.num) + " " + std::to_string(ref.gen);
+    for (int i = 0; i < 6; ++i)
+        key += " " + std::to_string(std::llround(matrix[i] * 100));
+    return key;
+}
+
+string get_path_key(GfxState * state, char op, const double * default_ictm)
+{
+    // the user space -> page space (in pt) matrix
+    double m[6];
+    tm_multiply(m, default_ictm, state->getCTM());
+
+    GfxRGB rgb;
+    if (op == 's')
+        state->getStrokeRGB(&rgb);
+    else
+        state->getFillRGB(&rgb);
+
+    string key(1, op);
+    key += " " + std::to_string(rgb.r) + " " + std::to_string(rgb.g) + " " + std::to_string(rgb.b);
+    if (op == 's')
+        key += " " + std::to_string(std::llround(state->getLineWidth() * 100));
+
+    // in 1/100 pt, as get_xobject_key()
+    GfxPath * path = state->getPath();
+    for (int i = 0; i < path->getNumSubpaths(); ++i)
+    {
+        GfxSubpath * subpath = path->getSubpath(i);
+        key += ";";
+        for (int j = 0; j < subpath->getNumPoints(); ++j)
+        {
+            double x = subpath->getX(j);
+            double y = subpath->getY(j);
+            tm_transform(m, x, y);
+            key += " " + std::to_string(std::llround(x * 100)) + " " + std::to_string(std::llround(y * 100));
+        }
+    }
+    return key;
+}
+
+string get_shading_key(GfxState * state, GfxAxialShading * shading, const double * default_ictm)
+{
+    // the shading space -> page space (in pt) matrix
+    double m[6];
+    tm_multiply(m, default_ictm, state->getCTM());
+
+    double coords[4];
+    shading->getCoords(&coords[0], &coords[1], &coords[2], &coords[3]);
+    tm_transform(m, coords[0], coords[1]);
+    tm_transform(m, coords[2], coords[3]);
+
+    // in 1/100 pt, as get_xobject_key()
+    string key = "a";
+    for (int i = 0; i < 4; ++i)
+        key += " " + std::to_string(std::llround(coords[i] * 100));
+    key += " " + std::to_string((int)shading->getExtend0()) + " " + std::to_string((int)shading->getExtend1());
+
+    // the colors at both ends
+    double domain[2] = { shading->getDomain0(), shading->getDomain1() };
+    for (double t : domain)
+    {
+        GfxColor color;
+        GfxRGB rgb;
+        shading->getColor(t, &color);
+        shading->getColorSpace()->getRGB(&color, &rgb);
+        key += " " + std::to_string(rgb.r) + " " + std::to_string(rgb.g) + " " + std::to_string(rgb.b);
+    }
+    return key;
+}
+
+bool get_file_digest(const string & filename, string & digest)
+{
+    ifstream fin(filename, ifstream::binary);
+    if (!fin)
+        return false;
+
+    // hash together with the size of the file
+    unsigned long long hash = DIGEST_SEED;
+    unsigned long long size = 0;
+    char buf[4096];
+    while (fin.read(buf, sizeof(buf)) || fin.gcount() > 0)
+    {
+        auto len = fin.gcount();
+        hash = update_digest(hash, buf, len);
+        size += len;
+    }
+
+    digest = std::to_string(hash) + " " + std::to_string(size);
+    return true;
+}
+
+bool same_file_content(const string & filename1, const string & filename2)
+{
+    ifstream fin1(filename1, ifstream::binary);
+    ifstream fin2(filename2, ifstream::binary);
+    if (!fin1 || !fin2)
+        return false;
+
+    char buf1[4096], buf2[4096];
+    while (true)
+    {
+        fin1.read(buf1, sizeof(buf1));
+        fin2.read(buf2, sizeof(buf2));
+        auto len = fin1.gcount();
+        if (len != fin2.gcount())
+            return false;
+        if (len == 0)
+            return true;
+        if (memcmp(buf1, buf2, len) != 0)
+            return false;
+    }
+}
+
+unsigned long long update_digest(unsigned long long hash, const void * data, size_t length)
+{
+    auto * p = (const unsigned char *)data;
+    for (size_t i = 0; i < length; ++i)
+    {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool is_passthrough_jpeg(Stream * str)
+{
+    if (str->getKind() != strDCT)
+        return false;
+
+    // We only dump rgb or gray jpeg without /Decode array.
+    //
+    // Although jpeg support CMYK, PDF readers do color conversion incompatibly with most other
+    // programs (including browsers): other programs invert CMYK color if 'Adobe' marker (app14) presents
+    // in a jpeg file; while PDF readers don't, they solely rely on /Decode array to invert color.
+    // It's a bit complicated to decide whether a CMYK jpeg is safe to dump, so we don't dump at all.
+    // See also:
+    //   JPEG file embedded in PDF (CMYK) https://forums.adobe.com/thread/975777
+    //   http://stackoverflow.com/questions/3123574/how-to-convert-from-cmyk-to-rgb-in-java-correctly
+    //
+    // In PDF, jpeg stream objects can also specify other color spaces like DeviceN and Separation,
+    // It is also not safe to dump them directly.
+    Object obj;
+    str->getDict()->lookup("ColorSpace", &obj);
+    if (!obj.isName() || (strcmp(obj.getName(), "DeviceRGB") && strcmp(obj.getName(), "DeviceGray")) )
+    {
+        obj.free();
+        return false;
+    }
+    obj.free();
+    str->getDict()->lookup("Decode", &obj);
+    if (obj.isArray())
+    {
+        obj.free();
+        return false;
+    }
+    obj.free();
+
+    return true;
+}
+
+bool read_jpeg_stream(Stream * str, string & data)
+{
+    // the stream below the DCT decoder gives the JPEG file
+    Stream * next = str->getNextStream();
+    if (!next)
+        return false;
+
+    data.clear();
+    int c;
+    next->reset();
+    while ((c = next->getChar()) != EOF)
+        data.push_back((char)c);
+    next->close();
+
+    return true;
+}
+
+bool dump_jpeg_stream(Stream * str, const string & filename)
+{
+    string data;
+    if (!read_jpeg_stream(str, data))
+        return false;
+
+    ofstream fout(filename, ofstream::binary);
+    if (!fout)
+        return false;
+    fout.write(data.data(), data.size());
+
+    return (bool)fout;
+}
+
+bool dump_bilevel_png(Stream * str, int width, int height, bool invert, double h_dpi, double v_dpi, const string & filename)
+{
+#ifdef ENABLE_LIBPNG
+    if ((width <= 0) || (height <= 0))
+        return false;
+
+    FILE * f = fopen(filename.c_str(), "wb");
+    if (!f)
+        return false;
+
+    // use unique_ptr to auto delete the object upon exception
+    unique_ptr<ImgWriter> writer(new PNGWriter(PNGWriter::MONOCHROME));
+    if (!writer->init(f, width, height, h_dpi, v_dpi))
+    {
+        fclose(f);
+        return false;
+    }
+
+    // 1-bit samples are packed, and each row starts at a byte boundary.
+    // PNG uses 1 for white, as PDF does unless there is a /Decode array
+    int row_size = (width + 7) / 8;
+    vector<unsigned char> row(row_size);
+    unsigned char mask = invert ? 0xff : 0;
+
+    bool ok = true;
+    str->reset();
+    for (int y = 0; ok && (y < height); ++y)
+    {
+        for (int x = 0; x < row_size; ++x)
+        {
+            int c = str->getChar();
+            if (c == EOF)
+            {
+                // treat missing data as white
+                c = invert ? 0 : 0xff;
+            }
+            row[x] = ((unsigned char)c) ^ mask;
+        }
+        unsigned char * p = row.data();
+        ok = writer->writeRow(&p);
+    }
+    str->close();
+
+    ok = writer->close() && ok;
+    fclose(f);
+    return ok;
+#else
+    return false;
+#endif
+}
+
+bool dump_png_image(Stream * str, int width, int height, GfxImageColorMap * colorMap, double h_dpi, double v_dpi, const string & filename)
+{
+#ifdef ENABLE_LIBPNG
+    if ((width <= 0) || (height <= 0))
+        return false;
+
+    FILE * f = fopen(filename.c_str(), "wb");
+    if (!f)
+        return false;
+
+    // use unique_ptr to auto delete the object upon exception
+    unique_ptr<ImgWriter> writer(new PNGWriter(PNGWriter::RGB));
+    if (!writer->init(f, width, height, h_dpi, v_dpi))
+    {
+        fclose(f);
+        return false;
+    }
+
+    int comps = colorMap->getNumPixelComps();
+    unique_ptr<ImageStream> img_stream(new ImageStream(str, width, comps, colorMap->getBits()));
+    vector<unsigned char> row(width * 3);
+
+    bool ok = true;
+    img_stream->reset();
+    for (int y = 0; ok && (y < height); ++y)
+    {
+        Guchar * p = img_stream->getLine();
+        for (int x = 0; p && (x < width); ++x)
+        {
+            GfxRGB rgb;
+            colorMap->getRGB(p, &rgb);
+            row[x * 3] = colToByte(rgb.r);
+            row[x * 3 + 1] = colToByte(rgb.g);
+            row[x * 3 + 2] = colToByte(rgb.b);
+            p += comps;
+        }
+        if (!p)
+        {
+            // treat missing data as white
+            std::fill(row.begin(), row.end(), 0xff);
+        }
+        unsigned char * r = row.data();
+        ok = writer->writeRow(&r);
+    }
+    img_stream->close();
+
+    ok = writer->close() && ok;
+    fclose(f);
+    return ok;
+#else
+    return false;
+#endif
+}
+
+bool write_palette_png(FILE * f, int width, int height, const unsigned char * palette, int palette_size,
+        unsigned char ** rows, double h_dpi, double v_dpi)
+{
+#if ENABLE_PALETTE_PNG
+    if ((width <= 0) || (height <= 0) || (palette_size <= 0) || (palette_size > 256))
+        return false;
+
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    if (!png)
+        return false;
+    png_infop info = png_create_info_struct(png);
+    if (!info)
+    {
+        png_destroy_write_struct(&png, nullptr);
+        return false;
+    }
+
+    // pack the indices with the least bit depth
+    int bit_depth = (palette_size <= 2) ? 1 : (palette_size <= 4) ? 2 : (palette_size <= 16) ? 4 : 8;
+    int pixels_per_byte = 8 / bit_depth;
+    vector<unsigned char> packed_row((width + pixels_per_byte - 1) / pixels_per_byte);
+
+    vector<png_color> colors(palette_size);
+    for (int i = 0; i < palette_size; ++i)
+    {
+        colors[i].red = palette[i * 3];
+        colors[i].green = palette[i * 3 + 1];
+        colors[i].blue = palette[i * 3 + 2];
+    }
+
+    // objects with destructors must be created before setjmp
+    if (setjmp(png_jmpbuf(png)))
+    {
+        png_destroy_write_struct(&png, &info);
+        return false;
+    }
+
+    png_init_io(png, f);
+    png_set_IHDR(png, info, width, height, bit_depth, PNG_COLOR_TYPE_PALETTE,
+            PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+
+    png_set_PLTE(png, info, colors.data(), palette_size);
+
+    // pixels per meter
+    png_set_pHYs(png, info, (png_uint_32)(h_dpi / 0.0254 + 0.5), (png_uint_32)(v_dpi / 0.0254 + 0.5), PNG_RESOLUTION_METER);
+
+    png_write_info(png, info);
+
+    for (int y = 0; y < height; ++y)
+    {
+        if (bit_depth == 8)
+        {
+            png_write_row(png, rows[y]);
+            continue;
+        }
+
+        std::fill(packed_row.begin(), packed_row.end(), 0);
+        for (int x = 0; x < width; ++x)
+        {
+            int shift = 8 - bit_depth * (x % pixels_per_byte + 1);
+            packed_row[x / pixels_per_byte] |= rows[y][x] << shift;
+        }
+        png_write_row(png, packed_row.data());
+    }
+
+    png_write_end(png, info);
+    png_destroy_write_struct(&png, &info);
+    return true;
+#else
+    return false;
+#endif
+}
+
+/*
+ * The source pixels covered by each destination pixel, along one axis
+ * Pixel i covers [i * scale, (i + 1) * scale) in the source,
+ * where the first and the last source pixels might be partially covered.
+ */
+struct BoxSpan
+{
+    int first, last;
+    double first_weight, last_weight;
+};
+
+static vector<BoxSpan> get_box_spans(int src_size, int dst_size)
+{
+    double scale = (double)src_size / dst_size;
+    vector<BoxSpan> spans(dst_size);
+    for (int i = 0; i < dst_size; ++i)
+    {
+        double start = i * scale;
+        double end = std::min((i + 1) * scale, (double)src_size);
+        auto & span = spans[i];
+        span.first = (int)start;
+        span.last = std::max(span.first, std::min((int)std::ceil(end) - 1, src_size - 1));
+        span.first_weight = std::min(end, span.first + 1.0) - start;
+        span.last_weight = (span.last > span.first) ? (end - span.last) : span.first_weight;
+    }
+    return spans;
+}
+
+void downscale_image(const unsigned char * src, int src_width, int src_height, int src_stride,
+        unsigned char * dst, int dst_width, int dst_height, int dst_stride, int pixel_size)
+{
+    auto x_spans = get_box_spans(src_width, dst_width);
+    auto y_spans = get_box_spans(src_height, dst_height);
+
+    // weighted sums of the current row of the destination
+    vector<double> sums(dst_width * pixel_size);
+    for (int y = 0; y < dst_height; ++y)
+    {
+        const auto & y_span = y_spans[y];
+        std::fill(sums.begin(), sums.end(), 0.0);
+        double total_y = 0;
+        for (int j = y_span.first; j <= y_span.last; ++j)
+        {
+            double wy = (j == y_span.first) ? y_span.first_weight : (j == y_span.last) ? y_span.last_weight : 1.0;
+            total_y += wy;
+            const unsigned char * row = src + j * src_stride;
+            for (int x = 0; x < dst_width; ++x)
+            {
+                const auto & x_span = x_spans[x];
+                double * sum = &sums[x * pixel_size];
+                for (int i = x_span.first; i <= x_span.last; ++i)
+                {
+                    double w = wy * ((i == x_span.first) ? x_span.first_weight : (i == x_span.last) ? x_span.last_weight : 1.0);
+                    const unsigned char * p = row + i * pixel_size;
+                    for (int c = 0; c < pixel_size; ++c)
+                        sum[c] += w * p[c];
+                }
+            }
+        }
+
+        unsigned char * out = dst + y * dst_stride;
+        for (int x = 0; x < dst_width; ++x)
+        {
+            const auto & x_span = x_spans[x];
+            double total_x = x_span.first_weight + ((x_span.last > x_span.first) ? x_span.last_weight : 0)
+                + std::max(0, x_span.last - x_span.first - 1);
+            double total = total_x * total_y;
+            for (int c = 0; c < pixel_size; ++c)
+                out[x * pixel_size + c] = (unsigned char)std::min(255.0, std::floor(sums[x * pixel_size + c] / total + 0.5));
+        }
+    }
+}
+
+bool write_webp(FILE * f, int width, int height, const unsigned char * rgb, int stride,
+        int quality, bool lossless, int effort)
+{
+#if ENABLE_WEBP
+    if ((width <= 0) || (height <= 0) || (width > WEBP_MAX_DIMENSION) || (height > WEBP_MAX_DIMENSION))
+        return false;
+
+    WebPConfig config;
+    if (!WebPConfigInit(&config))
+        return false;
+    config.lossless = lossless ? 1 : 0;
+    if (quality > 0)
+        config.quality = std::min(quality, 100);
+    if (effort >= 0)
+        config.method = std::min(effort, 10) * 6 / 10;
+
+    WebPPicture picture;
+    if (!WebPPictureInit(&picture))
+        return false;
+    picture.width = width;
+    picture.height = height;
+    // ARGB is preferred by the lossless encoder, YUV by the lossy one
+    picture.use_argb = config.lossless;
+
+    WebPMemoryWriter writer;
+    WebPMemoryWriterInit(&writer);
+    picture.writer = WebPMemoryWrite;
+    picture.custom_ptr = &writer;
+
+    bool ok = WebPPictureImportRGB(&picture, rgb, stride)
+        && WebPEncode(&config, &picture)
+        && (fwrite(writer.mem, 1, writer.size, f) == writer.size);
+
+    WebPPictureFree(&picture);
+    WebPMemoryWriterClear(&writer);
+    return ok;
+#else
+    return false;
+#endif
+}
+
+bool write_avif(FILE * f, int width, int height, const unsigned char * rgb, int stride,
+        int quality, bool lossless, int effort)
+{
+#if ENABLE_AVIF
+    if ((width <= 0) || (height <= 0))
+        return false;
+
+    // lossless AVIF needs full chroma and the identity matrix, i.e. RGB is not converted
+    avifImage * image = avifImageCreate(width, height, 8, AVIF_PIXEL_FORMAT_YUV444);
+    if (!image)
+        return false;
+    if (lossless)
+        image->matrixCoefficients = AVIF_MATRIX_COEFFICIENTS_IDENTITY;
+    image->yuvRange = AVIF_RANGE_FULL;
+
+    avifRGBImage rgb_image;
+    avifRGBImageSetDefaults(&rgb_image, image);
+    rgb_image.format = AVIF_RGB_FORMAT_RGB;
+    rgb_image.depth = 8;
+    // the pixels are not modified
+    rgb_image.pixels = const_cast<unsigned char *>(rgb);
+    rgb_image.rowBytes = stride;
+
+    avifEncoder * encoder = avifEncoderCreate();
+    if (!encoder)
+    {
+        avifImageDestroy(image);
+        return false;
+    }
+    // quantizers are 0 (lossless) - 63 (worst)
+    int quantizer = lossless ? AVIF_QUANTIZER_LOSSLESS
+        : (quality > 0) ? (100 - std::min(quality, 100)) * AVIF_QUANTIZER_WORST_QUALITY / 100
+        : 24;
+    encoder->minQuantizer = encoder->maxQuantizer = quantizer;
+    encoder->minQuantizerAlpha = encoder->maxQuantizerAlpha = AVIF_QUANTIZER_LOSSLESS;
+    if (effort >= 0)
+        encoder->speed = AVIF_SPEED_SLOWEST + (10 - std::min(effort, 10)) * (AVIF_SPEED_FASTEST - AVIF_SPEED_SLOWEST) / 10;
+
+    avifRWData output = AVIF_DATA_EMPTY;
+    bool ok = (avifImageRGBToYUV(image, &rgb_image) == AVIF_RESULT_OK)
+        && (avifEncoderWrite(encoder, image, &output) == AVIF_RESULT_OK)
+        && (fwrite(output.data, 1, output.size, f) == output.size);
+
+    avifRWDataFree(&output);
+    avifEncoderDestroy(encoder);
+    avifImageDestroy(image);
+    return ok;
+#else
+    return false;
+#endif
+}
+
+} //namespace pdf2htmlEX
@@ -0,0 +1,129 @@
+/*
+ * Functions handling image streams in PDF
+ */
+
+#ifndef IMAGE_H__
+#define IMAGE_H__
+
+#include <string>
+#include <cstdio>
+
+#include <Stream.h>
+#include <GfxState.h>
+#include <Object.h>
+
+namespace pdf2htmlEX {
+
+/*
+ * Identify an image drawn on a page, independent of the resolution of the output device
+ * ref: the image XObject
+ * ctm: the current CTM
+ * default_ictm: the inverse of the default CTM of the page
+ */
+std::string get_image_key(const Ref & ref, const double * ctm, const double * default_ictm);
+
+/*
+ * Identify an XObject drawn on a page
+ * matrix: the XObject space -> page space (in pt) matrix
+ */
+std::string get_xobject_key(const Ref & ref, const double * matrix);
+
+/*
+ * Identify a path filled or stroked on a page, independent of the resolution of the output device
+ * op: 'f' for fill, 'e' for eoFill, or 's' for stroke
+ * default_ictm: the inverse of the default CTM of the page
+ */
+std::string get_path_key(GfxState * state, char op, const double * default_ictm);
+
+/*
+ * Identify an axial shading drawn on a page, as get_path_key()
+ */
+std::string get_shading_key(GfxState * state, GfxAxialShading * shading, const double * default_ictm);
+
+/*
+ * Compute a digest of the content of a file, used to find identical images
+ * Return false on failure
+ */
+bool get_file_digest(const std::string & filename, std::string & digest);
+
+/*
+ * Whether two files have exactly the same content
+ * Files with the same digest must be compared before being treated as the same
+ */
+bool same_file_content(const std::string & filename1, const std::string & filename2);
+
+/*
+ * 64-bit FNV-1a hash, the one used by get_file_digest()
+ * Start with DIGEST_SEED, and update the hash with each block of data
+ */
+const unsigned long long DIGEST_SEED = 14695981039346656037ULL;
+unsigned long long update_digest(unsigned long long hash, const void * data, size_t length);
+
+/*
+ * Whether the encoded data of an image stream can be used as a .jpg file directly,
+ * i.e. it is a RGB or Gray JPEG without /Decode array
+ */
+bool is_passthrough_jpeg(Stream * str);
+
+/*
+ * Read the data of a DCT stream as it is, i.e. the input of the JPEG decoder
+ * Return false on failure
+ */
+bool read_jpeg_stream(Stream * str, std::string & data);
+
+/*
+ * Write the data of a DCT stream as it is, see read_jpeg_stream()
+ * Return false on failure
+ */
+bool dump_jpeg_stream(Stream * str, const std::string & filename);
+
+/*
+ * Decode a 1-bit image stream (e.g. JBIG2 or CCITT) and write it as a bilevel PNG file
+ * invert: whether 0 samples should be white
+ * Return false on failure, or if PNG is not supported
+ */
+bool dump_bilevel_png(Stream * str, int width, int height, bool invert, double h_dpi, double v_dpi, const std::string & filename);
+
+/*
+ * Decode an image stream with its color map, and write it as a RGB PNG file
+ * Return false on failure, or if PNG is not supported
+ */
+bool dump_png_image(Stream * str, int width, int height, GfxImageColorMap * colorMap, double h_dpi, double v_dpi, const std::string & filename);
+
+/*
+ * Write an image with at most 256 colors as an indexed PNG file
+ * palette: r, g, b of each color
+ * rows: color indices of each row, one byte per pixel
+ * Return false on failure, or if palette PNG is not supported
+ */
+bool write_palette_png(FILE * f, int width, int height, const unsigned char * palette, int palette_size,
+        unsigned char ** rows, double h_dpi, double v_dpi);
+
+/*
+ * Downscale an image with a box filter, i.e. each pixel is the average of the area it covers in the source
+ * pixel_size: bytes per pixel of both images
+ * src_stride, dst_stride: bytes per row
+ */
+void downscale_image(const unsigned char * src, int src_width, int src_height, int src_stride,
+        unsigned char * dst, int dst_width, int dst_height, int dst_stride, int pixel_size);
+
+/*
+ * Encode a RGB image as a WebP file
+ * rgb: the first pixel, 3 bytes per pixel, and stride bytes per row
+ * quality: 1-100, or 0 for the default of libwebp; ignored if lossless
+ * effort: 0 (fastest) - 10 (smallest), or -1 for the default of libwebp
+ * Return false on failure, or if WebP is not supported
+ */
+bool write_webp(FILE * f, int width, int height, const unsigned char * rgb, int stride,
+        int quality, bool lossless, int effort);
+
+/*
+ * Encode a RGB image as an AVIF file
+ * The parameters are the same as write_webp()
+ * Return false on failure, or if AVIF is not supported
+ */
+bool write_avif(FILE * f, int width, int height, const unsigned char * rgb, int stride,
+        int quality, bool lossless, int effort);
+
+} //namespace pdf2htmlEX
+#endif //IMAGE_H__
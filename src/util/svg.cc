@@ -0,0 +1,467 @@
+/*
+ * Functions handling SVG background images
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include <unordered_map>
+
+#include "pdf2htmlEX-config.h"
+
+#if ENABLE_SVGZ
+#include <zlib.h>
+#endif
+
+#include "svg.h"
+
+namespace pdf2htmlEX {
+
+using std::string;
+using std::vector;
+using std::unordered_map;
+using std::sqrt;
+using std::ceil;
+using std::log10;
+
+// shortest form of a number with at most precision decimal places, e.g. 0.50 -> .5
+static void append_number(string & out, double value, int precision)
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.*f", precision, value);
+    string s = buf;
+    if (s.find('.') != string::npos)
+    {
+        s.erase(s.find_last_not_of('0') + 1);
+        if (s.back() == '.')
+            s.pop_back();
+    }
+    if (s == "-0")
+        s = "0";
+    else if (s.compare(0, 2, "0.") == 0)
+        s.erase(0, 1);
+    else if (s.compare(0, 3, "-0.") == 0)
+        s.erase(1, 1);
+    out += s;
+}
+
+static string round_numbers(const string & value, int precision)
+{
+    string result;
+    result.reserve(value.size());
+    const char * p = value.c_str();
+    while (*p)
+    {
+        bool is_number = isdigit((unsigned char)p[0])
+            || ((p[0] == '.') && isdigit((unsigned char)p[1]))
+            || (((p[0] == '-') || (p[0] == '+')) && (isdigit((unsigned char)p[1]) || (p[1] == '.')));
+        if (is_number)
+        {
+            char * end = nullptr;
+            double v = strtod(p, &end);
+            if (end > p)
+            {
+                append_number(result, v, precision);
+                p = end;
+                continue;
+            }
+        }
+        result += *p;
+        ++p;
+    }
+    return result;
+}
+
+// round the numbers in the value of an attribute in a tag, if it exists
+static void round_attribute(string & tag, const char * name, int precision)
+{
+    string pattern = string(" ") + name + "=\"";
+    size_t start = tag.find(pattern);
+    if (start == string::npos)
+        return;
+    start += pattern.size();
+    size_t end = tag.find('"', start);
+    if (end == string::npos)
+        return;
+    tag.replace(start, end - start, round_numbers(tag.substr(start, end - start), precision));
+}
+
+static bool get_attribute(const string & tag, const char * name, string & value)
+{
+    string pattern = string(" ") + name + "=\"";
+    size_t start = tag.find(pattern);
+    if (start == string::npos)
+        return false;
+    start += pattern.size();
+    size_t end = tag.find('"', start);
+    if (end == string::npos)
+        return false;
+    value = tag.substr(start, end - start);
+    return true;
+}
+
+/*
+ * How much a transform list may stretch lengths, i.e. the largest singular value of its linear part
+ * HUGE_VAL if it cannot be parsed
+ */
+static double transform_scale(const string & value)
+{
+    double m[4] = { 1, 0, 0, 1 };
+    const char * p = value.c_str();
+    while (true)
+    {
+        while (isspace((unsigned char)*p) || (*p == ','))
+            ++p;
+        if (!*p)
+            break;
+
+        const char * name = p;
+        while (isalpha((unsigned char)*p))
+            ++p;
+        string func(name, p - name);
+        while (isspace((unsigned char)*p))
+            ++p;
+        if (*p != '(')
+            return HUGE_VAL;
+        ++p;
+
+        vector<double> args;
+        while (true)
+        {
+            while (isspace((unsigned char)*p) || (*p == ','))
+                ++p;
+            if (*p == ')')
+            {
+                ++p;
+                break;
+            }
+            char * end = nullptr;
+            double v = strtod(p, &end);
+            if (end == p)
+                return HUGE_VAL;
+            args.push_back(v);
+            p = end;
+        }
+
+        double t[4];
+        if ((func == "matrix") && (args.size() == 6))
+        {
+            t[0] = args[0]; t[1] = args[1]; t[2] = args[2]; t[3] = args[3];
+        }
+        else if ((func == "translate") && (args.size() >= 1) && (args.size() <= 2))
+        {
+            continue;
+        }
+        else if ((func == "scale") && (args.size() >= 1) && (args.size() <= 2))
+        {
+            t[0] = args[0]; t[1] = 0; t[2] = 0; t[3] = (args.size() == 2) ? args[1] : args[0];
+        }
+        else if ((func == "rotate") && ((args.size() == 1) || (args.size() == 3)))
+        {
+            // lengths are kept
+            continue;
+        }
+        else
+        {
+            return HUGE_VAL;
+        }
+
+        // m = m * t
+        double r[4] = {
+            m[0] * t[0] + m[2] * t[1],
+            m[1] * t[0] + m[3] * t[1],
+            m[0] * t[2] + m[2] * t[3],
+            m[1] * t[2] + m[3] * t[3],
+        };
+        memcpy(m, r, sizeof(r));
+    }
+
+    // the singular values are the square roots of the eigenvalues of m^T * m
+    double a = m[0] * m[0] + m[1] * m[1];
+    double b = m[0] * m[2] + m[1] * m[3];
+    double d = m[2] * m[2] + m[3] * m[3];
+    return sqrt((a + d) / 2 + sqrt((a - d) * (a - d) / 4 + b * b));
+}
+
+// elements that are not drawn where they are defined, but only through references
+static bool is_referenced_element(const string & tag)
+{
+    for (auto name : { "defs", "symbol", "clipPath", "mask", "pattern", "marker", "linearGradient", "radialGradient" })
+    {
+        size_t len = strlen(name);
+        if ((tag.compare(1, len, name) == 0) && !isalnum((unsigned char)tag[len + 1]))
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Walk through the tags, and find how much the coordinates in each tag are scaled to the output,
+ * i.e. the product of the scales of the transforms on the element and its ancestors,
+ * or through which it is referenced, e.g. by <use> or clip-path
+ *
+ * ref_scales: map<id, scale> used for referenced elements, an unknown id is not drawn
+ * new_ref_scales: the scales of the ids referenced by the tags are collected into it, if not null
+ * callback: called for each tag with its scale, 0 if not drawn
+ */
+template <class Callback>
+static void walk_tags(const string & svg, const unordered_map<string, double> & ref_scales,
+        unordered_map<string, double> * new_ref_scales, Callback callback)
+{
+    vector<double> scales;
+    size_t pos = 0;
+    while (true)
+    {
+        size_t lt = svg.find('<', pos);
+        if (lt == string::npos)
+            break;
+        size_t gt = svg.find('>', lt);
+        if (gt == string::npos)
+            break;
+        pos = gt + 1;
+        if ((svg[lt + 1] == '?') || (svg[lt + 1] == '!'))
+            continue;
+        if (svg[lt + 1] == '/')
+        {
+            if (!scales.empty())
+                scales.pop_back();
+            continue;
+        }
+
+        string tag = svg.substr(lt, gt - lt + 1);
+        double scale = scales.empty() ? 1 : scales.back();
+        if (is_referenced_element(tag))
+            scale = 0;
+        string value;
+        if (get_attribute(tag, "id", value))
+        {
+            auto iter = ref_scales.find(value);
+            if (iter != ref_scales.end())
+                scale = std::max(scale, iter->second);
+        }
+        if ((scale != 0)
+            && (get_attribute(tag, "transform", value) || get_attribute(tag, "patternTransform", value)))
+        {
+            scale *= transform_scale(value);
+            if (std::isnan(scale))
+                scale = HUGE_VAL;
+        }
+
+        if (new_ref_scales)
+        {
+            for (const char * pattern : { "href=\"#", "url(#" })
+            {
+                size_t start = 0;
+                while ((start = tag.find(pattern, start)) != string::npos)
+                {
+                    start += strlen(pattern);
+                    size_t end = tag.find_first_of("\")", start);
+                    if (end == string::npos)
+                        break;
+                    double & s = (*new_ref_scales)[tag.substr(start, end - start)];
+                    s = std::max(s, scale);
+                }
+            }
+        }
+
+        callback(tag, scale);
+
+        if (tag.compare(tag.size() - 2, 2, "/>") != 0)
+            scales.push_back(scale);
+    }
+}
+
+/*
+ * The number of decimal places for each tag, such that numbers are rounded to the given precision in the output
+ * -1 if they should not be rounded
+ */
+static vector<int> get_tag_precisions(const string & svg, int precision)
+{
+    // referenced elements, whose scales are not known yet, are not rounded
+    unordered_map<string, double> ref_scales;
+    walk_tags(svg, ref_scales, &ref_scales, [](const string &, double) { });
+    for (auto & p : ref_scales)
+        p.second = HUGE_VAL;
+
+    // the scales can only decrease, until all references are resolved
+    for (int i = 0; i < 8; ++i)
+    {
+        unordered_map<string, double> new_ref_scales;
+        walk_tags(svg, ref_scales, &new_ref_scales, [](const string &, double) { });
+        if (new_ref_scales == ref_scales)
+            break;
+        ref_scales.swap(new_ref_scales);
+    }
+
+    vector<int> precisions;
+    walk_tags(svg, ref_scales, nullptr, [&](const string &, double scale) {
+        if (!std::isfinite(scale))
+            precisions.push_back(-1);
+        else if (scale <= 1)
+            precisions.push_back(precision);
+        else
+            precisions.push_back(precision + (int)ceil(log10(scale) - 1e-6));
+    });
+    return precisions;
+}
+
+// whitespace, <g> without attributes and numbers
+static string minify_tags(const string & svg, int precision)
+{
+    vector<int> precisions;
+    if (precision >= 0)
+        precisions = get_tag_precisions(svg, precision);
+    size_t tag_index = 0;
+
+    string result;
+    result.reserve(svg.size());
+    // whether each open <g> is removed
+    vector<bool> groups;
+    size_t pos = 0;
+    while (pos < svg.size())
+    {
+        size_t lt = svg.find('<', pos);
+        size_t text_end = (lt == string::npos) ? svg.size() : lt;
+        if (svg.find_first_not_of(" \t\r\n", pos) < text_end)
+            result.append(svg, pos, text_end - pos);
+        if (lt == string::npos)
+            break;
+
+        size_t gt = svg.find('>', lt);
+        if (gt == string::npos)
+        {
+            result.append(svg, lt, string::npos);
+            break;
+        }
+        string tag = svg.substr(lt, gt - lt + 1);
+        pos = gt + 1;
+
+        // same tags as walk_tags()
+        int tag_precision = -1;
+        if ((tag[1] != '/') && (tag[1] != '?') && (tag[1] != '!') && (tag_index < precisions.size()))
+            tag_precision = precisions[tag_index++];
+
+        if ((tag == "<g>") || (tag == "<g/>"))
+        {
+            if (tag == "<g>")
+                groups.push_back(true);
+            continue;
+        }
+        if (tag == "</g>")
+        {
+            bool removed = !groups.empty() && groups.back();
+            if (!groups.empty())
+                groups.pop_back();
+            if (removed)
+                continue;
+        }
+        else if ((tag.compare(0, 3, "<g ") == 0) && (tag.compare(tag.size() - 2, 2, "/>") != 0))
+        {
+            groups.push_back(false);
+        }
+
+        if (tag_precision >= 0)
+        {
+            round_attribute(tag, "d", tag_precision);
+            round_attribute(tag, "x", tag_precision);
+            round_attribute(tag, "y", tag_precision);
+        }
+        result += tag;
+    }
+    return result;
+}
+
+// identical <symbol>, e.g. glyphs of the same shape
+static string merge_symbols(const string & svg)
+{
+    // map<symbol without id, id>
+    unordered_map<string, string> symbol_ids;
+    // map<id of a removed symbol, id of the identical one>
+    unordered_map<string, string> aliases;
+
+    string result;
+    result.reserve(svg.size());
+    size_t pos = 0;
+    while (true)
+    {
+        size_t start = svg.find("<symbol", pos);
+        if (start == string::npos)
+            break;
+        size_t end = svg.find("</symbol>", start);
+        if (end == string::npos)
+            break;
+        end += strlen("</symbol>");
+
+        result.append(svg, pos, start - pos);
+        pos = end;
+
+        string symbol = svg.substr(start, end - start);
+        size_t id_start = symbol.find(" id=\"");
+        size_t id_end = (id_start == string::npos) ? string::npos : symbol.find('"', id_start + 5);
+        if (id_end == string::npos)
+        {
+            result += symbol;
+            continue;
+        }
+
+        string id = symbol.substr(id_start + 5, id_end - id_start - 5);
+        auto p = symbol_ids.insert(std::make_pair(symbol.substr(0, id_start) + symbol.substr(id_end + 1), id));
+        if (p.second)
+            result += symbol;
+        else
+            aliases[id] = p.first->second;
+    }
+    result.append(svg, pos, string::npos);
+
+    if (aliases.empty())
+        return result;
+
+    // update references
+    string updated;
+    updated.reserve(result.size());
+    const string pattern = "href=\"#";
+    pos = 0;
+    while (true)
+    {
+        size_t start = result.find(pattern, pos);
+        size_t end = (start == string::npos) ? string::npos : result.find('"', start + pattern.size());
+        if (end == string::npos)
+            break;
+        start += pattern.size();
+        updated.append(result, pos, start - pos);
+
+        auto iter = aliases.find(result.substr(start, end - start));
+        if (iter != aliases.end())
+            updated += iter->second;
+        else
+            updated.append(result, start, end - start);
+        pos = end;
+    }
+    updated.append(result, pos, string::npos);
+    return updated;
+}
+
+string minify_svg(const string & svg, int precision)
+{
+    return merge_symbols(minify_tags(svg, precision));
+}
+
+bool write_gzip_file(const string & filename, const string & data)
+{
+#if ENABLE_SVGZ
+    gzFile f = gzopen(filename.c_str(), "wb9");
+    if (!f)
+        return false;
+    bool ok = data.empty() || (gzwrite(f, data.data(), data.size()) == (int)data.size());
+    ok = (gzclose(f) == Z_OK) && ok;
+    return ok;
+#else
+    return false;
+#endif
+}
+
+} //namespace pdf2htmlEX
@@ -0,0 +1,29 @@
+/*
+ * Functions handling SVG background images
+ */
+
+#ifndef SVG_H__
+#define SVG_H__
+
+#include <string>
+
+namespace pdf2htmlEX {
+
+/*
+ * Reduce the size of an SVG image generated by cairo, without visible changes
+ * - numbers in path data and x, y attributes are rounded to the given number of decimal places in the output,
+ *   i.e. with more places in elements scaled up by transforms, and not at all if a transform is not understood
+ * - identical <symbol> definitions, e.g. glyphs, are merged
+ * - <g> without attributes are removed
+ * - whitespace between tags is removed
+ */
+std::string minify_svg(const std::string & svg, int precision);
+
+/*
+ * Write data into a gzip file, e.g. .svgz
+ * Return false on failure, or if zlib is not supported
+ */
+bool write_gzip_file(const std::string & filename, const std::string & data);
+
+} //namespace pdf2htmlEX
+#endif //SVG_H__
@@ -3,6 +3,15 @@
 # Run browsers tests with a local Firefox
 
 import unittest
+import os
+import threading
+
+try:
+    from SimpleHTTPServer import SimpleHTTPRequestHandler
+    from SocketServer import TCPServer
+except ImportError:
+    from http.server import SimpleHTTPRequestHandler
+    from socketserver import TCPServer
 
 from selenium import webdriver
 from selenium.webdriver.common.by import By
@@ -36,5 +45,73 @@ class test_local_browser(BrowserTests, unittest.TestCase):
                 raise
         self.browser.save_screenshot(png_file)
 
+    def serve_directory(self, root):
+        # split pages cannot be loaded from file:// URLs
+        # the server ignores Range headers, so whole bundles are received
+        class Handler(SimpleHTTPRequestHandler):
+            def translate_path(self, path):
+                return os.path.join(root, os.path.basename(path.split('?', 1)[0]))
+            def log_message(self, *args):
+                pass
+        server = TCPServer(('127.0.0.1', 0), Handler)
+        thread = threading.Thread(target=server.serve_forever)
+        thread.daemon = True
+        thread.start()
+        self.addCleanup(server.server_close)
+        self.addCleanup(server.shutdown)
+        return 'http://127.0.0.1:%d/' % server.server_address[1]
+
+    def count_elements(self, selector):
+        return self.browser.execute_script('return document.querySelectorAll(arguments[0]).length', selector)
+
+    @unittest.skipIf(BrowserTests.GENERATING_MODE, 'No reference is needed for test_page_bundle')
+    def test_page_bundle(self):
+        pdf_file = os.path.join(self.TEST_DIR, 'test_output', '3-pages.pdf')
+        baseurl = self.serve_directory(self.TMPDIR)
+
+        self.run_pdf2htmlEX([pdf_file, '--split-pages', 1, '--page-bundle-size', 2])
+        self.browser.get(baseurl + '3-pages.html')
+        WebDriverWait(self.browser, 5).until(lambda browser: self.count_elements('#page-container > .pf .pc') == 3)
+        self.assertEqual(self.count_elements('#page-container .loading-indicator'), 0)
+
+        # the pages of a missing bundle are left as placeholders, without loading indicators
+        # other names are used, such that nothing is loaded from the cache
+        self.run_pdf2htmlEX([pdf_file, 'missing.html', '--split-pages', 1, '--page-bundle-size', 2,
+            '--page-filename', 'missing%d.page'])
+        os.remove(os.path.join(self.TMPDIR, 'missing1.page'))
+        self.browser.get(baseurl + 'missing.html')
+        WebDriverWait(self.browser, 5).until(lambda browser: self.count_elements('#pf3 .pc') == 1)
+        WebDriverWait(self.browser, 5).until(lambda browser: self.count_elements('#page-container .loading-indicator') == 0)
+        self.assertEqual(self.count_elements('#page-container > .pf .pc'), 1)
+
+    @unittest.skipIf(BrowserTests.GENERATING_MODE, 'No reference is needed for test_unload_pages')
+    def test_unload_pages(self):
+        self.run_pdf2htmlEX([os.path.join(self.TEST_DATA_DIR, 'ten_pages.pdf'), '--split-pages', 1])
+        html_file = os.path.join(self.TMPDIR, 'ten_pages.html')
+        with open(html_file) as f:
+            html = f.read()
+        viewer = 'new pdf2htmlEX.Viewer({})'
+        self.assertIn(viewer, html)
+        with open(html_file, 'w') as f:
+            f.write(html.replace(viewer, "new pdf2htmlEX.Viewer({'max_loaded_pages' : 2, 'preload_pages' : 1})"))
+        baseurl = self.serve_directory(self.TMPDIR)
+
+        scroll_to = lambda position: self.browser.execute_script(
+                'var c = document.getElementById("page-container"); c.scrollTop = arguments[0] * c.scrollHeight;', position)
+        is_loaded = lambda page_id: self.count_elements('#' + page_id + ' .pc') == 1
+
+        self.browser.get(baseurl + 'ten_pages.html')
+        WebDriverWait(self.browser, 5).until(lambda browser: is_loaded('pf1'))
+
+        # the first pages are put back as placeholders when the last ones are shown
+        scroll_to(1)
+        WebDriverWait(self.browser, 5).until(lambda browser: is_loaded('pfa'))
+        WebDriverWait(self.browser, 5).until(lambda browser: not is_loaded('pf1') and not is_loaded('pf2'))
+
+        # and loaded again when they are shown again
+        scroll_to(0)
+        WebDriverWait(self.browser, 5).until(lambda browser: is_loaded('pf1'))
+        WebDriverWait(self.browser, 5).until(lambda browser: not is_loaded('pfa'))
+
 if __name__ == '__main__':
     unittest.main()
@@ -1,13 +1,28 @@
 #!/usr/bin/env python
 
 # Check pdf2htmlEX does not crash, and produces correct files.
-# Do not check the content of the files
+# Do not check the content of the files, except for features that only show up in them
 
 import unittest
 import os
+import re
+import struct
+import json
+import subprocess
 
 from test import Common
 
+def get_supported_image_formats():
+    # listed by pdf2htmlEX -v, e.g. "Supported image format: png jpg svg"
+    p = subprocess.Popen([Common.PDF2HTMLEX_PATH, '-v'], stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    out, err = p.communicate()
+    for line in (out + err).decode('utf-8', 'replace').splitlines():
+        if line.startswith('Supported image format:'):
+            return line.split(':', 1)[1].split()
+    return []
+
+SUPPORTED_IMAGE_FORMATS = get_supported_image_formats()
+
 @unittest.skipIf(Common.GENERATING_MODE, 'Skipping test_output in generating mode')
 class test_output(Common, unittest.TestCase):
     def run_test_case(self, input_file, args=[], expected_output_files=None):
@@ -20,6 +35,19 @@ class test_output(Common, unittest.TestCase):
             print("test_output ", input_file, ": matched ", expected_output_files)
         else:
             print("test_output ", input_file, ": passed")
+        return result
+
+    def read_output_file(self, filename, mode='r'):
+        with open(os.path.join(self.TMPDIR, filename), mode) as f:
+            return f.read()
+
+    def get_png_size(self, filename):
+        # width and height in the IHDR chunk
+        return struct.unpack('>II', self.read_output_file(filename, 'rb')[16:24])
+
+    def get_png_color_type(self, filename):
+        # 0: grayscale, 2: truecolor, 3: palette, in the IHDR chunk
+        return ord(self.read_output_file(filename, 'rb')[25:26])
 
     def test_generate_single_html_default_name_single_page_pdf(self):
         self.run_test_case('1-page.pdf', expected_output_files = ['1-page.html'])
@@ -90,6 +118,363 @@ class test_output(Common, unittest.TestCase):
     def test_generate_single_html_name_specified_format_characters_percent_percent(self):
         self.run_test_case('2-pages.pdf', ['foo%%.html'], expected_output_files = ['foo%%.html'])
 
+    def test_bg_passthrough(self):
+        self.run_test_case('2-pages.pdf', ['--bg-passthrough', 1], expected_output_files = ['2-pages.html'])
+
+    def test_bg_passthrough_scanned_page(self):
+        self.run_test_case('scanned_page.pdf', ['--bg-passthrough', 1, '--embed-image', 0], expected_output_files = ['scanned_page.html', 'bg1.jpg'])
+        # the JPEG stream is copied as it is
+        with open(os.path.join(self.TEST_DIR, 'test_output', 'scanned_page.pdf'), 'rb') as f:
+            self.assertIn(self.read_output_file('bg1.jpg', 'rb'), f.read())
+        self.assertIn('src="bg1.jpg"', self.read_output_file('scanned_page.html'))
+
+    def test_extract_image(self):
+        self.run_test_case('2-pages.pdf', ['--extract-image', 1], expected_output_files = ['2-pages.html'])
+
+    def test_extract_image_shared_by_pages(self):
+        # the image is object 7, the bar below it is still in the background
+        self.run_test_case('images.pdf', ['--extract-image', 1, '--embed-image', 0],
+                expected_output_files = ['images.html', 'i700000000.png', 'bg1.png', 'bg2.png'])
+        self.assertEqual(self.get_png_size('i700000000.png'), (16, 8))
+        self.assertEqual(self.read_output_file('images.html').count('src="i700000000.png"'), 2)
+
+    def test_css_draw(self):
+        self.run_test_case('2-pages.pdf', ['--css-draw', 1], expected_output_files = ['2-pages.html'])
+
+    def test_css_draw_shapes(self):
+        # everything is drawn with CSS, the background is empty
+        self.run_test_case('shapes.pdf', ['--css-draw', 1, '--embed-image', 0], expected_output_files = ['shapes.html'])
+        html = self.read_output_file('shapes.html')
+        # the gray rectangle and the black line, with their colors in CSS classes
+        m = re.search(r'\.bc([0-9a-f]+)\{background:rgb\((1\d\d),\2,\2\);\}', html)
+        self.assertIsNotNone(m)
+        self.assertIn('<div class="bs bc' + m.group(1) + ' ', html)
+        m = re.search(r'\.bc([0-9a-f]+)\{background:rgb\(0,0,0\);\}', html)
+        self.assertIsNotNone(m)
+        self.assertIn('<div class="bs bc' + m.group(1) + ' ', html)
+        self.assertNotIn('style="background:', html)
+
+    def test_css_draw_gradient(self):
+        # a black to white shading from left to right, in a rectangular clip
+        self.run_test_case('shapes.pdf', ['--css-draw', 1, '--embed-image', 0], expected_output_files = ['shapes.html'])
+        html = self.read_output_file('shapes.html')
+        m = re.search(r'\.bc([0-9a-f]+)\{background:linear-gradient\(90(\.0*)?deg,rgb\(0,0,0\) -?[\d.]+%,rgb\(255,255,255\) -?[\d.]+%\);\}', html)
+        self.assertIsNotNone(m)
+        self.assertIn('<div class="bs bc' + m.group(1) + ' ', html)
+
+    def test_bg_shared_forms(self):
+        self.run_test_case('2-pages.pdf', ['--bg-shared-forms', 1], expected_output_files = ['2-pages.html'])
+
+    def test_bg_shared_forms_repeated_form(self):
+        # the logo is shared, the form with a transparency group is rendered in the backgrounds
+        self.run_test_case('repeated_form.pdf', ['--bg-shared-forms', 1, '--embed-image', 0],
+                expected_output_files = ['repeated_form.html', 'l0.png', 'bg1.png', 'bg2.png'])
+        self.assertEqual(self.read_output_file('repeated_form.html').count('src="l0.png"'), 2)
+
+    def test_bg_shared_forms_line_dash(self):
+        # the last page draws the form with dashed lines, which is not the initial graphics state
+        result = self.run_test_case('shared_dash.pdf', ['--bg-shared-forms', 1, '--embed-image', 0])
+        self.assertIn('l0.png', result['output_files'])
+        self.assertIn('bg3.png', result['output_files'])
+        html = self.read_output_file('shared_dash.html')
+        self.assertEqual(html.count('src="l0.png"'), 2)
+        self.assertIn('src="bg3.png"', html)
+
+    def test_bg_shared_forms_css_draw(self):
+        # the rule in the shared form is drawn with CSS, and left out of the layer with the triangle
+        result = self.run_test_case('shared_rule.pdf', ['--bg-shared-forms', 1, '--css-draw', 1, '--embed-image', 0])
+        self.assertIn('l0.png', result['output_files'])
+        width, height = self.get_png_size('l0.png')
+        self.assertLess(width, 300)
+        self.assertLess(height, 200)
+        self.assertEqual(self.read_output_file('shared_rule.html').count('<div class="bs '), 2)
+
+    def test_dedup_image(self):
+        # both pages have the same background
+        self.run_test_case('repeated_form.pdf', ['--dedup-image', 1, '--embed-image', 0],
+                expected_output_files = ['repeated_form.html', 'bg1.png'])
+        self.assertEqual(self.read_output_file('repeated_form.html').count('src="bg1.png"'), 2)
+
+    def test_dedup_image_embedded(self):
+        # the data of the background is embedded once, even for its first occurrence
+        self.run_test_case('repeated_form.pdf', ['--dedup-image', 1], expected_output_files = ['repeated_form.html'])
+        html = self.read_output_file('repeated_form.html')
+        self.assertEqual(html.count('data:image/png;base64,'), 1)
+        self.assertEqual(len(re.findall(r'<div class="bi bd0 ', html)), 2)
+        self.assertNotIn('<img class="bi ', html)
+
+    def test_bg_tile_size(self):
+        self.run_test_case('2-pages.pdf', ['--bg-tile-size', 256], expected_output_files = ['2-pages.html'])
+
+    def test_bg_solid_min_size(self):
+        self.run_test_case('2-pages.pdf', ['--bg-solid-min-size', 64], expected_output_files = ['2-pages.html'])
+
+    def test_bg_solid_min_size_shapes(self):
+        self.run_test_case('shapes.pdf', ['--embed-image', 0], expected_output_files = ['shapes.html', 'bg1.png'])
+        full_width, full_height = self.get_png_size('bg1.png')
+
+        # the gray rectangle on the top becomes a CSS box, the line and the shading below it are still in the background
+        self.run_test_case('shapes.pdf', ['--bg-solid-min-size', 64, '--embed-image', 0], expected_output_files = ['shapes.html', 'bg1.png'])
+        html = self.read_output_file('shapes.html')
+        m = re.search(r'\.bc([0-9a-f]+)\{background:#([0-9a-f]{2})\2\2;\}', html)
+        self.assertIsNotNone(m)
+        self.assertIn('<div class="bs bc' + m.group(1) + ' ', html)
+        width, height = self.get_png_size('bg1.png')
+        self.assertLess(height, full_height)
+
+    def test_process_vertical_text_off(self):
+        self.run_test_case('2-pages.pdf', ['--process-vertical-text', 0], expected_output_files = ['2-pages.html'])
+
+    def test_process_vertical_text(self):
+        # three chars in a font with the Identity-V encoding
+        chars = [u'\u7e26', u'\u66f8', u'\u304d']
+
+        self.run_test_case('vertical_text.pdf', expected_output_files = ['vertical_text.html'])
+        html = self.read_output_file('vertical_text.html', 'rb').decode('utf-8')
+        self.assertIn('<div class="t tv ', html)
+        for c in chars:
+            self.assertIn(c, html)
+
+        # rendered as image instead
+        self.run_test_case('vertical_text.pdf', ['--process-vertical-text', 0], expected_output_files = ['vertical_text.html'])
+        html = self.read_output_file('vertical_text.html', 'rb').decode('utf-8')
+        self.assertNotIn('<div class="t tv ', html)
+        for c in chars:
+            self.assertNotIn(c, html)
+
+    def test_links_to_page(self):
+        # a named and an explicit destination of the same place
+        self.run_test_case('outline_and_links.pdf', ['--process-outline', 0], expected_output_files = ['outline_and_links.html'])
+        self.assertEqual(self.read_output_file('outline_and_links.html').count(
+            '<a class="l" href="#pf2" data-dest-detail=\'[2,"XYZ",0,792,null]\'>'), 2)
+
+    def test_outline_chunk_depth(self):
+        self.run_test_case('2-pages.pdf', ['--outline-chunk-depth', 2], expected_output_files = ['2-pages.html'])
+
+    def test_outline_chunk_depth_nested(self):
+        # Chapter 1 > Section 1.1 > Section 1.1.1, Chapter 1 > Section 1.2, Chapter 2
+        self.run_test_case('outline_and_links.pdf', ['--outline-chunk-depth', 1],
+                expected_output_files = ['outline_and_links.html', 'outline_and_links.outline.1.json', 'outline_and_links.outline.2.json'])
+        m = re.search(r'<ul data-outline="([^"]*)"', self.read_output_file('outline_and_links.html'))
+        self.assertIsNotNone(m)
+        top = json.loads(m.group(1).replace('&quot;', '"').replace('&apos;', "'").replace('&amp;', '&'))
+        self.assertEqual([item[0] for item in top], ['Chapter 1', 'Chapter 2'])
+        self.assertEqual(top[0][3], 'outline_and_links.outline.1.json')
+        self.assertEqual(len(top[1]), 3)
+        chunk = json.loads(self.read_output_file('outline_and_links.outline.1.json'))
+        self.assertEqual([item[0] for item in chunk], ['Section 1.1', 'Section 1.2'])
+        self.assertEqual(chunk[0][3], 'outline_and_links.outline.2.json')
+        chunk = json.loads(self.read_output_file('outline_and_links.outline.2.json'))
+        self.assertEqual([item[0] for item in chunk], ['Section 1.1.1'])
+
+    def test_search_index(self):
+        self.run_test_case('2-pages.pdf', ['--search-index', 1], expected_output_files = ['2-pages.html', '2-pages.search.json'])
+
+    def test_search_index_terms(self):
+        # "Hello World" and "hello again" in two lines of the page
+        self.run_test_case('text.pdf', ['--search-index', 1], expected_output_files = ['text.html', 'text.search.json'])
+        index = json.loads(self.read_output_file('text.search.json'))
+        # terms are front coded
+        terms = []
+        for prefix_len, rest in zip(index['terms'][0::2], index['terms'][1::2]):
+            terms.append((terms[-1][:prefix_len] if terms else '') + rest)
+        self.assertEqual(terms, ['again', 'hello', 'world'])
+        # pages are relative to the previous pair, and lines too within the same page
+        lines = {}
+        for term, posting in zip(terms, index['postings']):
+            lines[term] = []
+            page_no = line_no = 0
+            for page_diff, line in zip(posting[0::2], posting[1::2]):
+                line_no = (line_no + line) if page_diff == 0 else line
+                page_no += page_diff
+                lines[term].append((page_no, line_no))
+        self.assertEqual(len(lines['world']), 1)
+        self.assertEqual(len(lines['again']), 1)
+        self.assertNotEqual(lines['world'], lines['again'])
+        self.assertEqual(lines['hello'], sorted(lines['world'] + lines['again']))
+        self.assertEqual(lines['hello'][0][0], 1)
+        self.assertEqual(lines['hello'][1][0], 1)
+
+    def test_text_json(self):
+        self.run_test_case('2-pages.pdf', ['--text-json', '2-pages.json'], expected_output_files = ['2-pages.json'])
+
+    def test_text_json_lines(self):
+        self.run_test_case('text.pdf', ['--text-json', 'text.json'], expected_output_files = ['text.json'])
+        lines = [json.loads(l) for l in self.read_output_file('text.json').splitlines()]
+        self.assertItemsEqual([line['text'] for line in lines], ['Hello World', 'hello again'])
+        for line in lines:
+            self.assertEqual(line['page'], 1)
+            self.assertEqual(len(line['bbox']), 4)
+            self.assertLess(line['bbox'][0], line['bbox'][2])
+            self.assertLess(line['bbox'][1], line['bbox'][3])
+            self.assertGreater(line['size'], 0)
+
+    def test_page_bundle_size(self):
+        self.run_test_case('3-pages.pdf', ['--split-pages', 1, '--page-bundle-size', 2], expected_output_files = ['3-pages.html', '3-pages1.page', '3-pages3.page'])
+        frames = re.findall(r'<div id="pf[0-9a-f]+" class="pf [^"]*" data-page-no="([0-9a-f]+)" data-page-url="([^"]*)"'
+                r' data-page-offset="([0-9a-f]+)" data-page-size="([0-9a-f]+)">', self.read_output_file('3-pages.html'))
+        self.assertEqual([(int(pageno, 16), url) for pageno, url, offset, size in frames],
+                [(1, '3-pages1.page'), (2, '3-pages1.page'), (3, '3-pages3.page')])
+        # the byte ranges cover the bundles, and each of them is exactly one page frame
+        end_offsets = {}
+        for pageno, url, offset, size in frames:
+            offset = int(offset, 16)
+            size = int(size, 16)
+            self.assertEqual(offset, end_offsets.get(url, 0))
+            end_offsets[url] = offset + size
+            page = self.read_output_file(url, 'rb')[offset:offset + size]
+            self.assertTrue(page.startswith(b'<div id="pf' + pageno.encode('ascii') + b'" class="pf '), page[:32])
+            self.assertEqual(len(re.findall(br'class="pf ', page)), 1)
+        for url, end in end_offsets.items():
+            self.assertEqual(end, len(self.read_output_file(url, 'rb')))
+
+    def test_bg_format_auto(self):
+        self.run_test_case('2-pages.pdf', ['--bg-format', 'auto'], expected_output_files = ['2-pages.html'])
+
+    def test_bg_format_auto_per_page(self):
+        # line-art is written as PNG, the color and the gray image as JPEG
+        self.run_test_case('backgrounds.pdf', ['--bg-format', 'auto', '--embed-image', 0],
+                expected_output_files = ['backgrounds.html', 'bg1.png', 'bg2.jpg', 'bg3.jpg'])
+        self.assertEqual(self.get_png_color_type('bg1.png'), 3)
+        for fn in ['bg2.jpg', 'bg3.jpg']:
+            self.assertEqual(self.read_output_file(fn, 'rb')[:2], b'\xff\xd8')
+        html = self.read_output_file('backgrounds.html')
+        for fn in ['bg1.png', 'bg2.jpg', 'bg3.jpg']:
+            self.assertIn('src="' + fn + '"', html)
+
+    @unittest.skipUnless('webp' in SUPPORTED_IMAGE_FORMATS, 'WebP is not supported by this build')
+    def test_bg_format_webp(self):
+        self.run_test_case('shapes.pdf', ['--bg-format', 'webp', '--embed-image', 0], expected_output_files = ['shapes.html', 'bg1.webp'])
+        data = self.read_output_file('bg1.webp', 'rb')
+        self.assertEqual(data[:4], b'RIFF')
+        self.assertEqual(data[8:12], b'WEBP')
+        self.assertIn('src="bg1.webp"', self.read_output_file('shapes.html'))
+
+    @unittest.skipUnless('avif' in SUPPORTED_IMAGE_FORMATS, 'AVIF is not supported by this build')
+    def test_bg_format_avif(self):
+        self.run_test_case('shapes.pdf', ['--bg-format', 'avif', '--embed-image', 0], expected_output_files = ['shapes.html', 'bg1.avif'])
+        self.assertEqual(self.read_output_file('bg1.avif', 'rb')[4:12], b'ftypavif')
+        self.assertIn('src="bg1.avif"', self.read_output_file('shapes.html'))
+
+    def test_bg_srcset(self):
+        # rendered at the density of 2 by default
+        self.run_test_case('shapes.pdf', ['--bg-srcset', '1,1.5', '--embed-image', 0],
+                expected_output_files = ['shapes.html', 'bg1.png', 'bg1-1x.png', 'bg1-1.5x.png'])
+        width, height = self.get_png_size('bg1.png')
+        for fn, scale in [('bg1-1x.png', 0.5), ('bg1-1.5x.png', 0.75)]:
+            self.assertEqual(self.get_png_size(fn), (int(width * scale + 0.5), int(height * scale + 0.5)))
+        self.assertRegexpMatches(self.read_output_file('shapes.html'),
+                r'srcset="bg1\.png 2(\.0*)?x, bg1-1x\.png 1(\.0*)?x, bg1-1\.5x\.png 1\.50*x"')
+
+    def test_bg_srcset_embed_image(self):
+        # no copies are left in the output directory when the backgrounds are embedded
+        self.run_test_case('shapes.pdf', ['--bg-srcset', '1,1.5'], expected_output_files = ['shapes.html'])
+        self.assertNotIn('srcset=', self.read_output_file('shapes.html'))
+
+    def test_svg_bitmap_format(self):
+        result = self.run_test_case('images.pdf', ['--bg-format', 'svg', '--svg-embed-bitmap', 0, '--svg-bitmap-format', 'jpg', '--embed-image', 0])
+        # the image used by both pages is written once, named by its digest
+        bitmaps = [fn for fn in result['output_files'] if fn not in ['images.html', 'bg1.svg', 'bg2.svg']]
+        self.assertEqual(len(bitmaps), 1)
+        self.assertRegexpMatches(bitmaps[0], r'^o[0-9a-f]{16}\.jpg$')
+        self.assertItemsEqual(result['output_files'], ['images.html', 'bg1.svg', 'bg2.svg', bitmaps[0]])
+        self.assertEqual(self.read_output_file(bitmaps[0], 'rb')[:2], b'\xff\xd8')
+        for fn in ['bg1.svg', 'bg2.svg']:
+            self.assertIn('"' + bitmaps[0] + '"', self.read_output_file(fn))
+
+    def test_svg_node_count_limit(self):
+        # falls back to a bitmap background when the SVG would be too large
+        self.run_test_case('shapes.pdf', ['--bg-format', 'svg', '--svg-node-count-limit', 1, '--embed-image', 0],
+                expected_output_files = ['shapes.html', 'bg1.png'])
+        self.assertIn('src="bg1.png"', self.read_output_file('shapes.html'))
+
+        self.run_test_case('shapes.pdf', ['--bg-format', 'svg', '--svg-node-count-limit', 100000, '--embed-image', 0],
+                expected_output_files = ['shapes.html', 'bg1.svg'])
+        self.assertIn('src="bg1.svg"', self.read_output_file('shapes.html'))
+
+    def test_thumbnail_width(self):
+        self.run_test_case('2-pages.pdf', ['--thumbnail-width', 128, '--embed-image', 0],
+                expected_output_files = ['2-pages.html', 'thumb1.png', 'thumb2.png', '2-pages.thumbnails.json'])
+        for fn in ['thumb1.png', 'thumb2.png']:
+            # letter size pages
+            width, height = self.get_png_size(fn)
+            self.assertEqual(width, 128)
+            self.assertAlmostEqual(height, 128 * 792 / 612.0, delta=1)
+        self.assertEqual(json.loads(self.read_output_file('2-pages.thumbnails.json')),
+                [{'page' : 1, 'file' : 'thumb1.png'}, {'page' : 2, 'file' : 'thumb2.png'}])
+
+    def test_svg_embed_mode_inline(self):
+        self.run_test_case('images.pdf', ['--bg-format', 'svg', '--svg-embed-mode', 'inline'], expected_output_files = ['images.html'])
+        html = self.read_output_file('images.html')
+        self.assertNotIn('<?xml', html)
+        self.assertNotIn('data:image/svg+xml', html)
+        svgs = re.findall(r'<svg class="bf".*?</svg>', html, re.S)
+        self.assertEqual(len(svgs), 2)
+        # ids of each page are prefixed, and so are the references to them
+        for pageno, svg in enumerate(svgs, 1):
+            prefix = 'p%d-' % pageno
+            self.assertIn('id="' + prefix, svg)
+            for ref in re.findall(r'(?:id="|url\(#|href="#)([^")]*)', svg):
+                self.assertTrue(ref.startswith(prefix), ref)
+
+    def test_svg_embed_mode_utf8(self):
+        self.run_test_case('images.pdf', ['--bg-format', 'svg', '--svg-embed-mode', 'utf8'], expected_output_files = ['images.html'])
+        html = self.read_output_file('images.html')
+        self.assertEqual(len(re.findall(r'src="data:image/svg\+xml;charset=utf-8,[^"<>#]*"', html)), 2)
+        self.assertNotIn('data:image/svg+xml;base64,', html)
+
+    def test_svg_minify(self):
+        # text is drawn as glyphs in the background in fallback mode
+        args = ['--bg-format', 'svg', '--fallback', 1, '--embed-image', 0]
+        files = ['2-pages.html', 'bg1.svg', 'bg2.svg']
+        self.run_test_case('2-pages.pdf', args, expected_output_files = files)
+        original = [self.read_output_file(fn) for fn in files[1:]]
+
+        self.run_test_case('2-pages.pdf', args + ['--svg-minify', 1], expected_output_files = files)
+        for fn, original_svg in zip(files[1:], original):
+            svg = self.read_output_file(fn)
+            self.assertLess(len(svg), len(original_svg))
+            # groups without attributes are dropped
+            self.assertNotRegexpMatches(svg, r'<g\s*/?>')
+            # identical symbols are merged, and references to the removed ones are updated
+            symbols = re.findall(r'<symbol[^>]*>.*?</symbol>', svg, re.S)
+            bodies = [re.sub(r' id="[^"]*"', '', symbol, 1) for symbol in symbols]
+            self.assertEqual(len(set(bodies)), len(bodies))
+            ids = set(re.findall(r' id="([^"]*)"', svg))
+            for ref in re.findall(r'href="#([^"]*)"', svg):
+                self.assertIn(ref, ids)
+
+    def test_bg_quantize(self):
+        self.run_test_case('2-pages.pdf', ['--bg-quantize', 1], expected_output_files = ['2-pages.html'])
+
+    def test_bg_gray_render(self):
+        self.run_test_case('2-pages.pdf', ['--bg-gray-render', 1], expected_output_files = ['2-pages.html'])
+
+    def test_bg_quantize_palette(self):
+        # red and blue boxes, an image with 4096 colors, and a gray image
+        files = ['backgrounds.html', 'bg1.png', 'bg2.png', 'bg3.png']
+        self.run_test_case('backgrounds.pdf', ['--embed-image', 0], expected_output_files = files)
+        self.assertEqual(self.get_png_color_type('bg1.png'), 3)
+        self.assertEqual(self.get_png_color_type('bg2.png'), 2)
+        self.assertEqual(self.get_png_color_type('bg3.png'), 0)
+
+        self.run_test_case('backgrounds.pdf', ['--bg-quantize', 1, '--embed-image', 0], expected_output_files = files)
+        self.assertEqual(self.get_png_color_type('bg1.png'), 3)
+        self.assertEqual(self.get_png_color_type('bg2.png'), 3)
+        self.assertEqual(self.get_png_color_type('bg3.png'), 0)
+
+    def test_bg_gray_render_gray_page(self):
+        files = ['backgrounds.html', 'bg1.png', 'bg2.png', 'bg3.png']
+        self.run_test_case('backgrounds.pdf', ['--embed-image', 0], expected_output_files = files)
+        gray_bg = self.read_output_file('bg3.png', 'rb')
+
+        # only the last page is rendered in grayscale, and it looks the same
+        self.run_test_case('backgrounds.pdf', ['--bg-gray-render', 1, '--embed-image', 0], expected_output_files = files)
+        self.assertEqual(self.get_png_color_type('bg1.png'), 3)
+        self.assertEqual(self.get_png_color_type('bg2.png'), 2)
+        self.assertEqual(self.get_png_color_type('bg3.png'), 0)
+        self.assertEqual(self.read_output_file('bg3.png', 'rb'), gray_bg)
+
     def test_issue501(self):
         self.run_test_case('issue501', ['--split-pages', 1, '--embed-css', 0]);
 